@@ -0,0 +1,30 @@
+#pragma once
+#include <pthread.h>
+#include <sched.h>
+#include <vector>
+
+// Привязывает текущий поток к ядру процессора cpu; при cpu < 0 ничего не делает
+inline bool PinCurrentThreadToCpu(int cpu) {
+    if (cpu < 0) {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// Ядра процессора, на которых процессу разрешено работать (учитывает taskset и cgroups)
+inline std::vector<int> AllowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
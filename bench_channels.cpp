@@ -0,0 +1,71 @@
+// Бенчмарк таблицы каналов: FixedChannelTable<N> (std::array, шаблон) против DynamicChannelTable (std::vector).
+// Измеряются поиск канала по имени (как в обработчиках команд) и цикл обновления значений
+// (как в RandomizeVoltage). Сборка: cmake -DMULTIMETER_BUILD_BENCH=ON, запуск: ./UDS_Bench
+#include "multimeter.h"
+#include <cstdio>
+
+using BenchClock = std::chrono::steady_clock;
+
+static const size_t LOOKUP_ROUNDS = 2000000;
+static const size_t UPDATE_ROUNDS = 200000;
+
+// Не даёт компилятору выбросить результат вычислений
+static volatile float sink;
+
+template <typename Table>
+static double BenchLookup(Table& table, const std::vector<std::string>& names) {
+    auto start = BenchClock::now();
+    float sum = 0.0f;
+    for (size_t i = 0; i < LOOKUP_ROUNDS; ++i) {
+        Channel* channel = table.Find(names[i % names.size()]);
+        if (channel != table.end()) {
+            sum += channel->current_value;
+        }
+    }
+    sink = sum;
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count() / LOOKUP_ROUNDS;
+}
+
+template <typename Table>
+static double BenchUpdate(Table& table) {
+    for (auto& channel : table) {
+        channel.state = measure_state;
+    }
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < UPDATE_ROUNDS; ++i) {
+        for (auto& channel : table) {
+            if (channel.state == measure_state || channel.state == busy_state) {
+                auto range = RANGE_LIMITS[channel.range];
+                channel.current_value = channel.rng.UniformFloat(range.first, range.second);
+            }
+        }
+    }
+    sink = table[0].current_value;
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count() / UPDATE_ROUNDS;
+}
+
+template <size_t N>
+static void Compare() {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < N; ++i) {
+        names.push_back("channel" + std::to_string((i * 7) % N));
+    }
+    // Таблицы большие (история значений в каждом канале), поэтому в куче
+    auto fixed = std::make_unique<FixedChannelTable<N>>();
+    auto dynamic = std::make_unique<DynamicChannelTable>(N);
+
+    double fixed_lookup = BenchLookup(*fixed, names);
+    double dynamic_lookup = BenchLookup(*dynamic, names);
+    double fixed_update = BenchUpdate(*fixed);
+    double dynamic_update = BenchUpdate(*dynamic);
+    std::printf("%8zu %14.1f %14.1f %14.1f %14.1f\n", N, fixed_lookup, dynamic_lookup, fixed_update, dynamic_update);
+}
+
+int main() {
+    std::printf("%8s %14s %14s %14s %14s\n", "channels", "find fixed", "find vector", "update fixed", "update vector");
+    std::printf("%8s %14s %14s %14s %14s\n", "", "ns/op", "ns/op", "ns/round", "ns/round");
+    Compare<MAX_CHANNELS>();
+    Compare<8>();
+    Compare<64>();
+    return 0;
+}
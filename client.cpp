@@ -39,10 +39,130 @@ void Client::disconnect_from_server() {
         sock_fd = -1;
         connected = false;
     }
+    input_buffer.clear();
+}
+
+void Client::SetEventHandler(std::function<void(const std::string&)> handler) {
+    event_handler = std::move(handler);
+}
+
+bool Client::WriteAll(const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(sock_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+int Client::ReadLine(std::string& line) {
+    size_t end;
+    while ((end = input_buffer.find('\r')) == std::string::npos) {
+        char buffer[1024];
+        ssize_t bytes_read = read(sock_fd, buffer, sizeof(buffer));
+        if (bytes_read <= 0) {
+            return static_cast<int>(bytes_read);
+        }
+        input_buffer.append(buffer, static_cast<size_t>(bytes_read));
+    }
+    line = input_buffer.substr(0, end);
+    input_buffer.erase(0, end + 1);
+    line.erase(std::remove(line.begin(), line.end(), '\n'), line.end());
+    return 1;
+}
+
+void Client::SetReadCache(std::chrono::milliseconds ttl) {
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    cache_ttl = ttl;
+    cache.clear();
+}
+
+// Кэшируются только чтения текущего значения и состояния; долгий опрос (after=) ждёт
+// именно нового значения, поэтому всегда идёт на сервер
+bool Client::IsCacheableRead(const std::string& command) {
+    return (command.compare(0, 11, "get_result ") == 0 || command.compare(0, 11, "get_status ") == 0) &&
+           command.find("after=") == std::string::npos;
+}
+
+// Запросы в полёте тоже убираются из кэша: их ответы могли быть получены до команды
+// управления, поэтому новые чтения к ним не присоединяются и в кэш они не попадут
+void Client::InvalidateCache() {
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    cache.clear();
+}
+
+std::string Client::CachedRead(const std::string& command) {
+    std::promise<std::string> reply;
+    std::shared_future<std::string> pending;
+    uint64_t id = 0;
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        auto it = cache.find(command);
+        if (it != cache.end() && it->second.ready && Clock::now() < it->second.expires) {
+            return it->second.response;
+        }
+        if (it != cache.end() && !it->second.ready) {
+            pending = it->second.pending; // Такой же запрос уже отправлен другим потоком
+        } else {
+            if (cache.size() >= CLIENT_CACHE_LIMIT) {
+                // Устаревшие ответы удаляются, только когда записей становится много
+                for (auto entry = cache.begin(); entry != cache.end();) {
+                    entry = entry->second.ready && entry->second.expires <= Clock::now() ? cache.erase(entry) : std::next(entry);
+                }
+            }
+            id = next_cache_id++;
+            cache[command] = {id, false, Clock::time_point(), std::string(), reply.get_future().share()};
+        }
+    }
+    if (id == 0) {
+        return pending.get();
+    }
+
+    std::string response = Exchange(command);
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        auto it = cache.find(command);
+        if (it != cache.end() && it->second.id == id) {
+            // Ошибки связи и отказы сервера не кэшируются
+            if (response.compare(0, 2, "ok") == 0 && cache_ttl.count() > 0) {
+                it->second.ready = true;
+                it->second.expires = Clock::now() + cache_ttl;
+                it->second.response = response;
+                it->second.pending = std::shared_future<std::string>();
+            } else {
+                cache.erase(it);
+            }
+        }
+    }
+    reply.set_value(response);
+    return response;
 }
 
-// Метод для отправки команды по установленному соединению
 std::string Client::SendCommand(const std::string& command) {
+    bool cache_enabled;
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        cache_enabled = cache_ttl.count() > 0;
+    }
+    if (!cache_enabled) {
+        return Exchange(command);
+    }
+    if (IsCacheableRead(command)) {
+        return CachedRead(command);
+    }
+    // Команда может изменить состояние каналов - сбрасываем кэш после её выполнения
+    std::string response = Exchange(command);
+    InvalidateCache();
+    return response;
+}
+
+// Метод для отправки команды по установленному соединению
+std::string Client::Exchange(const std::string& command) {
+    std::lock_guard<std::mutex> io_lock(io_mtx);
     if (!connected) {
         // Попытаться переподключиться, если соединение было потеряно
         std::cerr << "Соединение потеряно, попытка переподключения...\r";
@@ -60,17 +180,20 @@ std::string Client::SendCommand(const std::string& command) {
         return "не удалось отправить команду, соединение, возможно, разорвано\r";
     }
 
-    char buffer[1024] = {0};
-    ssize_t bytes_read = read(sock_fd, buffer, sizeof(buffer) - 1);
-
-    if (bytes_read > 0) {
-        buffer[bytes_read] = '\0';
-        std::string response(buffer);
-        while (!response.empty() && (response.back() == '\r' || response.back() == '\n')) {
-            response.pop_back();
+    std::string response;
+    int result;
+    // Асинхронные события могут прийти раньше ответа - передаём их обработчику
+    while ((result = ReadLine(response)) > 0 && response.compare(0, 6, "event,") == 0) {
+        if (event_handler) {
+            event_handler(response);
+        } else {
+            std::cout << response << std::endl;
         }
+    }
+
+    if (result > 0) {
         return response;
-    } else if (bytes_read == 0) {
+    } else if (result == 0) {
         // Сервер закрыл соединение
         std::cerr << "Client: Сервер закрыл соединение.\r";
         disconnect_from_server();
@@ -82,3 +205,70 @@ std::string Client::SendCommand(const std::string& command) {
         return "ошибка чтения ответа, соединение, возможно, разорвано\r";
     }
 }
+
+bool Client::RunBatch(std::istream& input, std::ostream& output, size_t window, bool record_latency) {
+    std::lock_guard<std::mutex> io_lock(io_mtx);
+    if (!connected) {
+        std::cerr << "Client: Нет соединения с сервером\r";
+        return false;
+    }
+    if (window == 0) {
+        window = 1;
+    }
+
+    std::deque<Clock::time_point> in_flight; // Время отправки команд, ожидающих ответа
+    bool input_done = false;
+    std::string command;
+    while (!input_done || !in_flight.empty()) {
+        // Дополняем окно и отправляем все новые команды одной записью
+        std::string batch;
+        std::vector<Clock::time_point> batch_times;
+        while (!input_done && in_flight.size() + batch_times.size() < window) {
+            if (!std::getline(input, command) || command == "exit") {
+                input_done = true;
+                break;
+            }
+            command.erase(std::remove(command.begin(), command.end(), '\r'), command.end());
+            if (command.empty()) { continue; }
+            batch += command + "\r";
+            batch_times.push_back(Clock::now());
+        }
+        if (!batch.empty()) {
+            if (!WriteAll(batch)) {
+                std::cerr << "Client: Ошибка отправки команды\r";
+                disconnect_from_server();
+                return false;
+            }
+            in_flight.insert(in_flight.end(), batch_times.begin(), batch_times.end());
+        }
+        if (in_flight.empty()) {
+            continue;
+        }
+
+        std::string response;
+        int result;
+        // В stdout пакетного режима - только ответы, по строке на команду; события - в stderr
+        while ((result = ReadLine(response)) > 0 && response.compare(0, 6, "event,") == 0) {
+            if (event_handler) {
+                event_handler(response);
+            } else {
+                std::cerr << response << std::endl;
+            }
+        }
+        if (result <= 0) {
+            std::cerr << "Client: Соединение разорвано, ответов не получено: " << in_flight.size() << "\r";
+            disconnect_from_server();
+            return false;
+        }
+
+        output << response;
+        if (record_latency) {
+            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - in_flight.front());
+            output << '\t' << latency.count();
+        }
+        output << '\n';
+        in_flight.pop_front();
+    }
+    output.flush();
+    return true;
+}
@@ -6,20 +6,72 @@
 #include <unistd.h>
 #include <string.h>
 #include <algorithm>
+#include <functional>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <map>
+#include <iterator>
+#include <mutex>
+#include <future>
 
 const std::string CLIENT_SOCKET_PATH = "/tmp/multimeter.sock"; // Путь к сокету сервера
+const std::chrono::milliseconds CLIENT_CACHE_TTL = std::chrono::seconds(1); // Период обновления значений сервера по умолчанию
+const size_t CLIENT_CACHE_LIMIT = 1024; // Число записей кэша, после которого удаляются устаревшие
 
 class Client {
 public:
     Client(); // Конструктор
     ~Client(); // Деструктор
 
-    // Метод для отправки команды по уже установленному соединению
+    // Метод для отправки команды по уже установленному соединению; можно вызывать из нескольких потоков
     std::string SendCommand(const std::string& command);
 
+    // Кэш чтений: успешные ответы get_result/get_status хранятся ttl и выдаются без обращения
+    // к серверу, одинаковые одновременные чтения объединяются в один запрос. Любая другая
+    // команда этого клиента сбрасывает кэш. ttl = 0 - кэш выключен (по умолчанию).
+    void SetReadCache(std::chrono::milliseconds ttl = CLIENT_CACHE_TTL);
+
+    // Пакетный режим: отправляет команды из input (по одной в строке), держа без ответа не более
+    // window команд, и пишет ответы в output в порядке команд. С record_latency после ответа
+    // через табуляцию выводится время от отправки команды до ответа в микросекундах.
+    bool RunBatch(std::istream& input, std::ostream& output, size_t window, bool record_latency);
+
+    // Обработчик асинхронных событий сервера (строки "event, ..."). По умолчанию события выводятся
+    // в std::cout, а в пакетном режиме - в std::cerr, чтобы не смешиваться с ответами
+    void SetEventHandler(std::function<void(const std::string&)> handler);
+
 private:
+    using Clock = std::chrono::steady_clock;
+
+    struct CacheEntry {
+        uint64_t id;                         // Отличает запрос, заполняющий запись
+        bool ready;                          // false - запрос ещё выполняется
+        Clock::time_point expires;
+        std::string response;
+        std::shared_future<std::string> pending;
+    };
+
+    std::mutex io_mtx; // Одна команда в сокете за раз
+    std::mutex cache_mtx;
+    std::chrono::milliseconds cache_ttl{0};
+    std::map<std::string, CacheEntry> cache;
+    uint64_t next_cache_id = 1;
+
     int sock_fd; // Файловый дескриптор сокета
     bool connected; // Флаг состояния соединения
+    std::string input_buffer; // Принятые, но ещё не разобранные данные
+    std::function<void(const std::string&)> event_handler;
+
+    // Отправляет команду и ждёт ответа, захватывая io_mtx
+    std::string Exchange(const std::string& command);
+    std::string CachedRead(const std::string& command);
+    void InvalidateCache();
+    static bool IsCacheableRead(const std::string& command);
+
+    bool WriteAll(const std::string& data);
+    // Читает одну строку (до CR) из сокета; 0 - сервер закрыл соединение, -1 - ошибка
+    int ReadLine(std::string& line);
 
     // Приватные методы для установки и разрыва соединения
     bool connect_to_server();
@@ -0,0 +1,122 @@
+#include "instrumented_mutex.h"
+#include "tracer.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+void DurationHistogram::Add(uint64_t ns) {
+    size_t bucket = 0;
+    while (bucket + 1 < buckets.size() && (ns >> (bucket + 1)) != 0) {
+        ++bucket;
+    }
+    ++buckets[bucket];
+    ++count;
+    total_ns += ns;
+    if (ns > max_ns) {
+        max_ns = ns;
+    }
+}
+
+uint64_t DurationHistogram::Percentile(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(p * count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen > target || seen == count) {
+            return std::min<uint64_t>(uint64_t(1) << (i + 1), max_ns);
+        }
+    }
+    return max_ns;
+}
+
+static uint64_t Nanoseconds(InstrumentedMutex::Clock::duration duration) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+LockSiteStats& InstrumentedMutex::Site(const char* site) {
+    for (auto& stats : sites_) {
+        if (stats.site == site || strcmp(stats.site, site) == 0) {
+            return stats;
+        }
+    }
+    sites_.emplace_back();
+    sites_.back().site = site;
+    return sites_.back();
+}
+
+void InstrumentedMutex::lock(const char* site) {
+    TraceSpan wait_span("lock_wait");
+    Clock::time_point start = Clock::now();
+    mtx_.lock();
+    acquired_ = Clock::now();
+    wait_span.End();
+
+    LockSiteStats& stats = Site(site);
+    ++stats.acquisitions;
+    stats.wait.Add(Nanoseconds(acquired_ - start));
+    owner_site_ = site;
+}
+
+bool InstrumentedMutex::try_lock(const char* site) {
+    if (!mtx_.try_lock()) {
+        return false;
+    }
+    acquired_ = Clock::now();
+    LockSiteStats& stats = Site(site);
+    ++stats.acquisitions;
+    stats.wait.Add(0);
+    owner_site_ = site;
+    return true;
+}
+
+void InstrumentedMutex::unlock() {
+    Site(owner_site_).hold.Add(Nanoseconds(Clock::now() - acquired_));
+    owner_site_ = nullptr;
+    mtx_.unlock();
+}
+
+// Одна строка: "site count=N wait_avg_ns=... wait_p50_ns=... wait_p99_ns=... wait_max_ns=... hold_...; site2 ..."
+std::string InstrumentedMutex::Report() const {
+    std::ostringstream os;
+    for (size_t i = 0; i < sites_.size(); ++i) {
+        const LockSiteStats& stats = sites_[i];
+        const DurationHistogram* histograms[] = {&stats.wait, &stats.hold};
+        const char* names[] = {"wait", "hold"};
+        os << (i ? "; " : "") << stats.site << " count=" << stats.acquisitions;
+        for (size_t h = 0; h < 2; ++h) {
+            const DurationHistogram& histogram = *histograms[h];
+            os << " " << names[h] << "_avg_ns=" << (histogram.count ? histogram.total_ns / histogram.count : 0)
+               << " " << names[h] << "_p50_ns=" << histogram.Percentile(0.5)
+               << " " << names[h] << "_p99_ns=" << histogram.Percentile(0.99)
+               << " " << names[h] << "_max_ns=" << histogram.max_ns;
+        }
+    }
+    return os.str();
+}
+
+void InstrumentedMutex::ResetStats() {
+    sites_.clear();
+}
+
+InstrumentedLock::InstrumentedLock(InstrumentedMutex& mutex, const char* site) : mutex_(mutex), site_(site) {
+    lock();
+}
+
+InstrumentedLock::~InstrumentedLock() {
+    if (owns_) {
+        mutex_.unlock();
+    }
+}
+
+void InstrumentedLock::lock() {
+    mutex_.lock(site_);
+    owns_ = true;
+}
+
+void InstrumentedLock::unlock() {
+    owns_ = false;
+    mutex_.unlock();
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Гистограмма длительностей: корзина i - длительности в [2^i, 2^(i+1)) наносекунд
+struct DurationHistogram {
+    std::array<uint64_t, 40> buckets{};
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+
+    void Add(uint64_t ns);
+    // Верхняя граница корзины, в которую попадает доля p (0..1) значений
+    uint64_t Percentile(double p) const;
+};
+
+// Статистика захватов мьютекса из одного места (обработчик команды или фоновый поток)
+struct LockSiteStats {
+    const char* site = nullptr;
+    uint64_t acquisitions = 0;
+    DurationHistogram wait; // Ожидание захвата
+    DurationHistogram hold; // Удержание
+};
+
+// Мьютекс со сбором статистики: число захватов и гистограммы ожидания и удержания по местам захвата.
+// Статистика обновляется, пока мьютекс захвачен, поэтому отдельная блокировка для неё не нужна.
+// Ожидание захвата также пишется в трассировку как интервал "lock_wait".
+class InstrumentedMutex {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void lock() { lock("unknown"); }
+    void lock(const char* site);
+    bool try_lock(const char* site = "unknown");
+    void unlock();
+
+    // Вызываются с захваченным мьютексом
+    std::string Report() const;
+    void ResetStats();
+
+private:
+    std::mutex mtx_;
+    const char* owner_site_ = nullptr;
+    Clock::time_point acquired_;
+    std::vector<LockSiteStats> sites_;
+
+    LockSiteStats& Site(const char* site);
+};
+
+// Аналог std::unique_lock для InstrumentedMutex с указанием места захвата.
+// Подходит для std::condition_variable_any: повторный захват после ожидания
+// учитывается за тем же местом.
+class InstrumentedLock {
+public:
+    InstrumentedLock(InstrumentedMutex& mutex, const char* site);
+    ~InstrumentedLock();
+    InstrumentedLock(const InstrumentedLock&) = delete;
+    InstrumentedLock& operator=(const InstrumentedLock&) = delete;
+
+    void lock();
+    void unlock();
+
+private:
+    InstrumentedMutex& mutex_;
+    const char* site_;
+    bool owns_ = false;
+};
@@ -0,0 +1,64 @@
+// Проверка долгого опроса в реальном времени: несколько потоков ставят get_result ... after=
+// в очередь ожидания, пока поток таймера ядра спит до ближайшего события. Каждый запрос
+// должен получить ровно один ответ - новое значение или "fail, timeout".
+// Сборка вместе с сервером, запуск: ctest или ./UDS_LongPollCheck (полезно со сборкой -fsanitize=address)
+#include "multimeter.h"
+#include <atomic>
+#include <cstdio>
+
+static const int THREADS = 4;
+static const int REQUESTS_PER_THREAD = 200;
+static const auto REPLY_DEADLINE = std::chrono::seconds(10);
+
+int main() {
+    MultimeterConfig config;
+    config.seed = 42;
+    config.sample_period = std::chrono::milliseconds(100);
+    MultimeterCore core(config);
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    int replies = 0;
+    int unexpected = 0;
+    auto count_reply = [&](const std::string& reply) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (reply.compare(0, 4, "ok, ") != 0 && reply != "fail, timeout\r") {
+            std::printf("неожиданный ответ: %s\n", reply.c_str());
+            ++unexpected;
+        }
+        ++replies;
+        cv.notify_all();
+    };
+    core.ProcessCommandAsync("start_measure channel0", nullptr, [](const std::string&) {});
+    core.ProcessCommandAsync("start_measure channel1", nullptr, [](const std::string&) {});
+
+    // Запросы с after=4000000000 не выполнятся никогда и заканчиваются тайм-аутом: их события
+    // попадают в очередь таймера, пока поток таймера ждёт очередного обновления значений
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&core, &count_reply, t]() {
+            for (int i = 0; i < REQUESTS_PER_THREAD; ++i) {
+                std::string channel = "channel" + std::to_string((t + i) % 2);
+                std::string after = i % 4 == 0 ? "0" : "4000000000";
+                std::string timeout = std::to_string(50 + (i * 7) % 250);
+                core.ProcessCommandAsync("get_result " + channel + ", after=" + after + ", timeout=" + timeout,
+                                         nullptr, count_reply);
+                if (i % 16 == 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::unique_lock<std::mutex> lock(mtx);
+    bool done = cv.wait_for(lock, REPLY_DEADLINE, [&replies]() { return replies == THREADS * REQUESTS_PER_THREAD; });
+    if (!done || unexpected != 0) {
+        std::printf("FAIL: ответов %d из %d, неожиданных %d\n", replies, THREADS * REQUESTS_PER_THREAD, unexpected);
+        return 1;
+    }
+    std::printf("OK, %d ответов\n", replies);
+    return 0;
+}
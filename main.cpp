@@ -1,16 +1,162 @@
 #include "multimeter.h"
 #include "server.h"
 #include "client.h" // Включаем client.h для использования класса Client
+#include "affinity.h"
 #include <iostream>
 #include <string>
+#include <cstring>
+#include <fstream>
 
-int main() {
 #ifdef SERVER
-    MultimeterCore core; // Создаем экземпляр MultimeterCore
-    Server server(core); // Передаем его в Server
+// Разбор параметров сервера вида "--workers 8 --queue 512 --max-clients 128 --simulate --seed 42 --sample-period 100
+// --devices 16 --shards 4 --pin --trace-sample 100 --control-uid 1000 --bulk-rate 5000"
+static bool ParseServerArgs(int argc, char* argv[], ServerConfig& config, MultimeterConfig& core_config,
+                            size_t& device_count) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--simulate") == 0) {
+            core_config.simulation = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--pin") == 0) {
+            config.pin_cpus = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Не задано значение параметра " << argv[i] << std::endl;
+            return false;
+        }
+        if (strcmp(argv[i], "--control-rate") == 0 || strcmp(argv[i], "--bulk-rate") == 0) {
+            try {
+                config.rate_limit[argv[i][2] == 'c' ? control_priority : bulk_priority] = std::stod(argv[i + 1]);
+            } catch (...) {
+                std::cerr << "Некорректное значение параметра " << argv[i] << ": " << argv[i + 1] << std::endl;
+                return false;
+            }
+            ++i;
+            continue;
+        }
+        size_t value;
+        try {
+            value = std::stoul(argv[i + 1]);
+        } catch (...) {
+            std::cerr << "Некорректное значение параметра " << argv[i] << ": " << argv[i + 1] << std::endl;
+            return false;
+        }
+        bool positive = strcmp(argv[i], "--sample-period") == 0 || strcmp(argv[i], "--devices") == 0 ||
+                        strcmp(argv[i], "--shards") == 0;
+        if (positive && value == 0) {
+            std::cerr << "Некорректное значение параметра " << argv[i] << ": " << argv[i + 1] << std::endl;
+            return false;
+        }
+        if (strcmp(argv[i], "--workers") == 0) {
+            config.worker_count = value;
+        } else if (strcmp(argv[i], "--queue") == 0) {
+            config.queue_limit = value;
+        } else if (strcmp(argv[i], "--max-clients") == 0) {
+            config.max_clients = value;
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            core_config.seed = value;
+        } else if (strcmp(argv[i], "--sample-period") == 0) {
+            core_config.sample_period = std::chrono::milliseconds(value);
+        } else if (strcmp(argv[i], "--devices") == 0) {
+            device_count = value;
+        } else if (strcmp(argv[i], "--shards") == 0) {
+            config.shard_count = value;
+        } else if (strcmp(argv[i], "--trace-sample") == 0) {
+            config.trace_sample = static_cast<uint32_t>(value);
+        } else if (strcmp(argv[i], "--control-uid") == 0) {
+            config.control_uid = static_cast<int>(value);
+        } else if (strcmp(argv[i], "--control-gid") == 0) {
+            config.control_gid = static_cast<int>(value);
+        } else {
+            std::cerr << "Неизвестный параметр: " << argv[i] << std::endl;
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+#else
+// Параметры клиента для пакетного режима: "--batch [файл] --window 64 --latency"
+struct BatchOptions {
+    bool enabled = false;
+    std::string path;   // Пусто или "-" - читать команды из stdin
+    size_t window = 32; // Сколько команд может ожидать ответа одновременно
+    bool latency = false;
+};
+
+static bool ParseClientArgs(int argc, char* argv[], BatchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--batch") == 0) {
+            options.enabled = true;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                options.path = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            options.latency = true;
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            try {
+                options.window = std::stoul(argv[++i]);
+            } catch (...) {
+                std::cerr << "Некорректное значение параметра --window: " << argv[i] << std::endl;
+                return false;
+            }
+        } else {
+            std::cerr << "Неизвестный параметр: " << argv[i] << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+int main(int argc, char* argv[]) {
+#ifdef SERVER
+    ServerConfig config;
+    MultimeterConfig core_config;
+    size_t device_count = 1;
+    config.shard_count = 0;
+    if (!ParseServerArgs(argc, argv, config, core_config, device_count)) {
+        return 1;
+    }
+    if (config.shard_count == 0) {
+        // По умолчанию - шард на устройство, но не больше, чем ядер процессора
+        config.shard_count = std::min<size_t>(device_count, std::max<size_t>(1, AllowedCpus().size()));
+    }
+
+    // Каждое устройство - отдельный MultimeterCore со своей блокировкой и таймером,
+    // поток таймера работает на ядре процессора шарда устройства
+    std::vector<std::unique_ptr<MultimeterCore>> cores;
+    std::vector<MultimeterCore*> devices;
+    for (size_t i = 0; i < device_count; ++i) {
+        MultimeterConfig device_config = core_config;
+        device_config.seed = core_config.seed != 0 ? core_config.seed + i : 0;
+        device_config.cpu = config.pin_cpus ? Server::ShardCpu(i % std::min(config.shard_count, device_count)) : -1;
+        if (device_count > 1) {
+            device_config.device_name = "dev" + std::to_string(i);
+        }
+        cores.push_back(std::make_unique<MultimeterCore>(device_config));
+        devices.push_back(cores.back().get());
+    }
+    Server server(devices, config); // Передаем устройства в Server
     server.Run();
 #else
+    BatchOptions batch;
+    if (!ParseClientArgs(argc, argv, batch)) {
+        return 1;
+    }
     Client client;
+    if (batch.enabled) {
+        if (batch.path.empty() || batch.path == "-") {
+            return client.RunBatch(std::cin, std::cout, batch.window, batch.latency) ? 0 : 1;
+        }
+        std::ifstream file(batch.path);
+        if (!file) {
+            std::cerr << "Не удалось открыть файл " << batch.path << std::endl;
+            return 1;
+        }
+        return client.RunBatch(file, std::cout, batch.window, batch.latency) ? 0 : 1;
+    }
     std::string command;
     while (true) {
         std::cout << "> " << std::flush; // Явный сброс буфера
@@ -1,65 +1,258 @@
 #include "multimeter.h"
+#include "affinity.h"
+#include "tracer.h"
+
+static const auto BUSY_DURATION = std::chrono::seconds(10);
+// Автодиапазон: переход вниз только после нескольких подряд значений заметно ниже
+// нижней границы диапазона (гистерезис), чтобы диапазон не переключался туда-обратно
+static const int AUTO_RANGE_DOWN_SAMPLES = 3;
+static const float AUTO_RANGE_DOWN_MARGIN = 0.9f;
+static const float INPUT_LOG10_MIN = -7.0f; // Границы входного сигнала: 0.0000001 ... 1000000 В
+static const float INPUT_LOG10_MAX = 6.0f;
+static const size_t TRIGGER_CAPTURE_MAX = 64; // Максимум значений до/после срабатывания триггера
+static const unsigned long POLL_TIMEOUT_DEFAULT_MS = 10000; // Долгий опрос get_result ... after=SEQ
+static const unsigned long POLL_TIMEOUT_MAX_MS = 60000;
+static const size_t POLL_WAITERS_MAX = 1024;                // Ожидающих запросов на канал
+static const long long ADVANCE_TIME_MAX_MS = 3600000;       // Шаг advance_time: события шага выполняются под mtx
+static const size_t WINDOW_DIGITS_MAX = 9;                  // Цифр в окне get_result ..., avg=T / decimate=N
+
+static uint64_t MakeSeed(uint64_t seed) {
+    if (seed != 0) {
+        return seed;
+    }
+    std::random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) | rd();
+}
 
-MultimeterCore::MultimeterCore() : gen(rd()) {
-    channels.resize(MAX_CHANNELS);
+MultimeterCore::MultimeterCore(const MultimeterConfig& config)
+    : config(config), seed(MakeSeed(config.seed)), schedule_rng(seed, MAX_CHANNELS) {
     ChannelsInit();
-    voltage_thread = std::thread(&MultimeterCore::RandomizeVoltage, this);
-    state_thread = std::thread(&MultimeterCore::RandomizeChannelState, this);
+    start_time = NowLocked();
+    Schedule(config.sample_period, voltage_event);
+    Schedule(std::chrono::seconds(schedule_rng.UniformInt(10, 15)), state_event);
+    if (!config.simulation) {
+        timer_thread = std::thread(&MultimeterCore::TimerLoop, this);
+    }
 }
 
 MultimeterCore::~MultimeterCore() {
-    running = false;
-    if (voltage_thread.joinable()) {
-        voltage_thread.join();
+    {
+        InstrumentedLock lock(mtx, "shutdown");
+        running = false;
     }
-    if (state_thread.joinable()) {
-        state_thread.join();
+    timer_cv.notify_all();
+    if (timer_thread.joinable()) {
+        timer_thread.join();
     }
 }
 
-void MultimeterCore::RandomizeVoltage() {
+SimClock::time_point MultimeterCore::NowLocked() const {
+    return config.simulation ? virtual_now : SimClock::now();
+}
+
+SimClock::time_point MultimeterCore::Now() {
+    InstrumentedLock lock(mtx, "Now");
+    return NowLocked();
+}
+
+void MultimeterCore::Schedule(SimClock::duration delay, TimerEventType type, size_t channel, uint64_t waiter) {
+    events.push({NowLocked() + delay, event_order++, type, channel, waiter});
+    timer_cv.notify_all();
+}
+
+void MultimeterCore::RunDueEvents(SimClock::time_point until) {
+    while (!events.empty() && events.top().time <= until) {
+        TimerEvent event = events.top();
+        events.pop();
+        if (config.simulation) {
+            virtual_now = event.time;
+        }
+        switch (event.type) {
+        case voltage_event:
+            RandomizeVoltage();
+            Schedule(config.sample_period, voltage_event);
+            break;
+        case state_event: {
+            RandomizeChannelState();
+            Schedule(std::chrono::seconds(schedule_rng.UniformInt(10, 15)), state_event);
+            break;
+        }
+        case busy_recovery_event:
+            if (channels[event.channel].state == busy_state) {
+                channels[event.channel].state = measure_state;
+            }
+            break;
+        case poll_timeout_event:
+            ExpireWaiter(event.channel, event.waiter);
+            break;
+        }
+    }
+}
+
+bool MultimeterCore::AdvanceTime(SimClock::duration duration) {
+    InstrumentedLock lock(mtx, "AdvanceTime");
+    if (!config.simulation || duration < SimClock::duration::zero()) {
+        return false;
+    }
+    SimClock::time_point target = virtual_now + duration;
+    RunDueEvents(target);
+    virtual_now = target;
+    DeliverNotifications(lock);
+    return true;
+}
+
+// Отправляет накопленные события и отложенные ответы клиентам без удержания mtx, чтобы медленный
+// клиент не задерживал обновление каналов; lock на выходе снова захвачен
+void MultimeterCore::DeliverNotifications(InstrumentedLock& lock) {
+    if (notifications.empty() && completions.empty()) {
+        return;
+    }
+    auto pending = std::move(notifications);
+    notifications.clear();
+    auto replies = std::move(completions);
+    completions.clear();
+    lock.unlock();
+    for (const auto& notification : pending) {
+        if (notification.first->notify) {
+            notification.first->notify(notification.second);
+        }
+    }
+    for (const auto& reply : replies) {
+        reply.first(reply.second);
+    }
+    lock.lock();
+}
+
+// Фоновый поток реального времени: спит до ближайшего события и выполняет его
+void MultimeterCore::TimerLoop() {
+    PinCurrentThreadToCpu(config.cpu);
+    InstrumentedLock lock(mtx, "timer");
     while (running) {
-        {
-            std::lock_guard<std::mutex> lock(mtx);
-            for (auto& channel : channels) {
-                if (channel.state == measure_state || channel.state == busy_state) {
-                    auto range = channel.ranges_voltage[channel.range];
-                    std::uniform_real_distribution<float> dist(range.first, range.second);
-                    channel.current_value = dist(gen);
+        if (events.empty()) {
+            timer_cv.wait(lock);
+        } else if (SimClock::now() < events.top().time) {
+            // Срок копируется: пока поток ждёт, mtx свободен, и Schedule из рабочего потока
+            // (долгий опрос) может перевыделить память очереди событий
+            SimClock::time_point next = events.top().time;
+            timer_cv.wait_until(lock, next);
+        } else {
+            RunDueEvents(SimClock::now());
+            DeliverNotifications(lock);
+        }
+    }
+}
+
+void MultimeterCore::RandomizeVoltage() {
+    for (auto& channel : channels) {
+        if (channel.state == measure_state || channel.state == busy_state) {
+            if (channel.auto_range) {
+                MeasureAutoRange(channel);
+            } else {
+                auto range = RANGE_LIMITS[channel.range];
+                channel.current_value = channel.rng.UniformFloat(range.first, range.second);
+            }
+            channel.sample_time = NowLocked();
+            ++channel.sample_seq;
+            channel.history.Add(channel.sample_time, channel.current_value);
+            EvaluateTriggers(channel);
+            CompleteWaiters(channel);
+        }
+    }
+}
+
+// Имя канала для событий: с именем устройства, если сервер обслуживает несколько устройств
+std::string MultimeterCore::ChannelLabel(const Channel& channel) const {
+    return config.device_name.empty() ? channel.name : config.device_name + "/" + channel.name;
+}
+
+// Проверка триггеров канала на новом значении; вызывается при каждом обновлении напряжения
+void MultimeterCore::EvaluateTriggers(Channel& channel) {
+    if (channel.triggers.empty()) {
+        return;
+    }
+    float value = channel.current_value;
+
+    for (auto it = channel.triggers.begin(); it != channel.triggers.end();) {
+        auto session = it->session.lock();
+        if (!session) {
+            it = channel.triggers.erase(it); // Клиент отключился
+            continue;
+        }
+
+        if (it->post_remaining > 0) {
+            it->captured.push_back(value);
+            if (--it->post_remaining == 0) {
+                std::ostringstream event;
+                event << "event, capture, " << ChannelLabel(channel);
+                for (float sample : it->captured) {
+                    event << ", " << sample;
                 }
+                event << "\r";
+                notifications.emplace_back(session, event.str());
+                it->captured.clear();
+            }
+        }
+
+        bool condition = it->above ? value >= it->threshold : value <= it->threshold;
+        if (condition && it->armed) {
+            it->armed = false;
+            std::ostringstream event;
+            event << "event, trigger, " << ChannelLabel(channel) << ", " << (it->above ? "above" : "below") << ", "
+                  << it->threshold << ", " << value << "\r";
+            notifications.emplace_back(session, event.str());
+            if (it->capture > 0 && it->post_remaining == 0) {
+                // Значения до срабатывания (включая текущее) уже есть, дожидаемся значений после
+                it->captured = channel.history.LastValues(it->capture);
+                it->post_remaining = it->capture;
             }
+        } else if (!condition) {
+            it->armed = true;
         }
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        ++it;
     }
 }
 
+// В режиме автодиапазона входной сигнал не привязан к диапазону: он медленно блуждает
+// по всей шкале, а ядро само подбирает диапазон, в котором сигнал можно измерить
+void MultimeterCore::MeasureAutoRange(Channel& channel) {
+    channel.input_log10 += channel.rng.UniformFloat(-0.5f, 0.5f);
+    channel.input_log10 = std::min(std::max(channel.input_log10, INPUT_LOG10_MIN), INPUT_LOG10_MAX);
+    float input = std::pow(10.0f, channel.input_log10);
+
+    // Перегрузка - сразу переходим на больший диапазон и измеряем заново
+    while (channel.range < range3 && input >= RANGE_LIMITS[channel.range].second) {
+        channel.range = static_cast<Ranges>(channel.range + 1);
+        channel.under_range_samples = 0;
+    }
+
+    auto range = RANGE_LIMITS[channel.range];
+    if (channel.range > range0 && input < range.first * AUTO_RANGE_DOWN_MARGIN) {
+        if (++channel.under_range_samples >= AUTO_RANGE_DOWN_SAMPLES) {
+            channel.range = static_cast<Ranges>(channel.range - 1);
+            channel.under_range_samples = 0;
+            range = RANGE_LIMITS[channel.range];
+        }
+    } else {
+        channel.under_range_samples = 0;
+    }
+
+    // Значение канала всегда остаётся в пределах текущего диапазона
+    channel.current_value = std::min(std::max(input, range.first), std::nextafter(range.second, range.first));
+}
+
 void MultimeterCore::RandomizeChannelState() {
-    std::uniform_int_distribution<> check_interval(10, 15);
-    std::uniform_real_distribution<float> chance(0.0f, 1.0f);
     const float ERROR = 0.02f;
     const float BUSY = 0.2f;
 
-    while (running) {
-        std::this_thread::sleep_for(std::chrono::seconds(check_interval(gen)));
-        {
-            std::lock_guard<std::mutex> lock(mtx);
-            for (auto& channel : channels) {
-                if (channel.state == measure_state) {
-                    float roll = chance(gen);
-                    if (roll < ERROR) {
-                        channel.state = error_state;
-                    } else if (roll < BUSY) {
-                        channel.state = busy_state;
-                        // Захватываем this и channel по ссылке
-                        std::thread([this, &channel]() {
-                            std::this_thread::sleep_for(std::chrono::seconds(10));
-                            std::lock_guard<std::mutex> lock(this->mtx);
-                            if (channel.state == busy_state) {
-                                channel.state = measure_state;
-                            }
-                        }).detach();
-                    }
-                }
+    for (size_t i = 0; i < channels.size(); ++i) {
+        auto& channel = channels[i];
+        if (channel.state == measure_state) {
+            float roll = channel.rng.UniformFloat(0.0f, 1.0f);
+            if (roll < ERROR) {
+                channel.state = error_state;
+            } else if (roll < BUSY) {
+                channel.state = busy_state;
+                Schedule(BUSY_DURATION, busy_recovery_event, i);
             }
         }
     }
@@ -67,7 +260,7 @@ void MultimeterCore::RandomizeChannelState() {
 
 void MultimeterCore::ChannelsInit() {
     for (size_t i = 0; i < channels.size(); ++i) {
-        channels[i].name = "channel" + std::to_string(i);
+        channels[i].rng = Philox4x32(seed, i);
     }
     current_channel_count = channels.size();
 }
@@ -83,16 +276,7 @@ std::string MultimeterCore::ChannelStateToString(ChannelState state) {
 }
 
 bool MultimeterCore::isValidChannel(const std::string& channel_par) const {
-
-    if (channel_par.substr(0, 7) != "channel") {
-        return false;
-    }
-    try {
-        size_t channel_num = std::stoul(channel_par.substr(7));
-        return channel_num < MAX_CHANNELS;
-    } catch (...) {
-        return false;
-    }
+    return ParseChannelIndex(channel_par) < MAX_CHANNELS;
 }
 
  /*
@@ -109,14 +293,13 @@ bool MultimeterCore::isValidRange(const std::string& range_par) const {
     }
 } */
 
-std::vector<Channel>::iterator MultimeterCore::FindChannelByName(const std::string& channel_par) {
-    return std::find_if(channels.begin(), channels.end(),
-                        [&channel_par](const Channel& channel) { return channel.name == channel_par; });
+Channel* MultimeterCore::FindChannelByName(const std::string& channel_par) {
+    return channels.Find(channel_par);
 }
 
 void MultimeterCore::StartMeasure(const std::string& channel_par, std::ostream& os) {
 
-    std::lock_guard<std::mutex> lock(mtx);
+    InstrumentedLock lock(mtx, "StartMeasure");
     auto it = FindChannelByName(channel_par);
     if (it != channels.end()) {
         it->state = measure_state;
@@ -128,12 +311,21 @@ void MultimeterCore::StartMeasure(const std::string& channel_par, std::ostream&
 
 void MultimeterCore::SetRange(const std::string& channel_par, const std::string& range_par, std::ostream& os) {
 
-    std::lock_guard<std::mutex> lock(mtx);
+    InstrumentedLock lock(mtx, "SetRange");
     auto it = FindChannelByName(channel_par);
     if (it != channels.end() && it->state == idle_state) {
 
-        size_t range_num = std::stoul(range_par.substr(5));
-        it->range = static_cast<Ranges>(range_num);
+        if (range_par == "auto") {
+            // Начинаем с середины текущего диапазона (в логарифмической шкале)
+            auto range = RANGE_LIMITS[it->range];
+            it->auto_range = true;
+            it->input_log10 = (std::log10(range.first) + std::log10(range.second)) / 2.0f;
+            it->under_range_samples = 0;
+        } else {
+            size_t range_num = std::stoul(range_par.substr(5));
+            it->range = static_cast<Ranges>(range_num);
+            it->auto_range = false;
+        }
         os << "ok, " << range_par << "\r";
 
     } else {
@@ -143,7 +335,7 @@ void MultimeterCore::SetRange(const std::string& channel_par, const std::string&
 
 void MultimeterCore::StopMeasure(const std::string& channel_par, std::ostream& os) {
 
-    std::lock_guard<std::mutex> lock(mtx);
+    InstrumentedLock lock(mtx, "StopMeasure");
     auto it = FindChannelByName(channel_par);
     if (it != channels.end() && it->state != error_state && it->state != busy_state) {
         it->state = idle_state;
@@ -155,7 +347,7 @@ void MultimeterCore::StopMeasure(const std::string& channel_par, std::ostream& o
 
 void MultimeterCore::GetStatus(const std::string& channel_par, std::ostream& os) {
 
-    std::lock_guard<std::mutex> lock(mtx);
+    InstrumentedLock lock(mtx, "GetStatus");
     auto it = FindChannelByName(channel_par);
     if (it != channels.end() && it->state != error_state) {
         os << "ok, " << ChannelStateToString(it->state) << "\r";
@@ -164,19 +356,252 @@ void MultimeterCore::GetStatus(const std::string& channel_par, std::ostream& os)
     }
 }
 
+// "ok, значение, номер значения, время получения в мс от запуска ядра"
+void MultimeterCore::FormatResult(const Channel& channel, std::ostream& os) const {
+    auto time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(channel.sample_time - start_time);
+    os << "ok, " /*<< std::fixed << std::setprecision(7)*/ << channel.current_value << ", " << channel.sample_seq
+       << ", " << time_ms.count() << "\r";
+}
+
 void MultimeterCore::GetResult(const std::string& channel_par, std::ostream& os) {
 
-    std::lock_guard<std::mutex> lock(mtx);
+    InstrumentedLock lock(mtx, "GetResult");
     auto it = FindChannelByName(channel_par);
-    if (it != channels.end() && it->state == measure_state) {
-        os << "ok, " /*<< std::fixed << std::setprecision(7)*/ << it->current_value << "\r";
+    // До первого значения (sample_seq == 0) отвечать нечем
+    if (it != channels.end() && it->state == measure_state && it->sample_seq > 0) {
+        FormatResult(*it, os);
     } else {
         os << "fail\r";
     }
 }
 
+// get_result channelN, after=SEQ[, timeout=MS] - ответ, как только у канала появится значение
+// с номером больше SEQ, или "fail, timeout" по истечении времени
+bool MultimeterCore::WaitResult(const std::string& channel_par, const std::vector<std::string>& args,
+                                const ReplyCallback& done, std::ostream& os) {
+    uint64_t after = 0;
+    unsigned long timeout_ms = POLL_TIMEOUT_DEFAULT_MS;
+    bool has_after = false;
+    for (const auto& arg : args) {
+        size_t pos = 0;
+        if (arg.compare(0, 6, "after=") == 0) {
+            // std::stoull принимает "-1" и превращает его в UINT64_MAX - такой запрос не выполнился бы никогда
+            if (arg.size() == 6 || !std::isdigit(static_cast<unsigned char>(arg[6]))) {
+                has_after = false;
+                break;
+            }
+            after = std::stoull(arg.substr(6), &pos);
+            has_after = pos == arg.size() - 6;
+        } else if (arg.compare(0, 8, "timeout=") == 0) {
+            if (arg.size() == 8 || !std::isdigit(static_cast<unsigned char>(arg[8]))) {
+                has_after = false;
+                break;
+            }
+            timeout_ms = std::stoul(arg.substr(8), &pos);
+            if (pos != arg.size() - 8 || timeout_ms > POLL_TIMEOUT_MAX_MS) {
+                has_after = false;
+                break;
+            }
+        } else {
+            has_after = false;
+            break;
+        }
+    }
+    if (!has_after) {
+        os << "fail\r";
+        return false;
+    }
+
+    InstrumentedLock lock(mtx, "WaitResult");
+    auto it = FindChannelByName(channel_par);
+    if (it == channels.end()) {
+        os << "fail\r";
+        return false;
+    }
+    if (it->sample_seq > after && it->state == measure_state) {
+        FormatResult(*it, os);
+        return false;
+    }
+    if (timeout_ms == 0) {
+        os << "fail, timeout\r";
+        return false;
+    }
+    if (it->waiters.size() >= POLL_WAITERS_MAX) {
+        os << "fail, overloaded\r";
+        return false;
+    }
+    uint64_t id = next_waiter_id++;
+    it->waiters.push_back({id, after, done});
+    Schedule(std::chrono::milliseconds(timeout_ms), poll_timeout_event, static_cast<size_t>(it - channels.begin()), id);
+    return true;
+}
+
+// Новое значение канала: отвечаем всем ожидающим, если канал в measure_state
+void MultimeterCore::CompleteWaiters(Channel& channel) {
+    if (channel.waiters.empty() || channel.state != measure_state) {
+        return;
+    }
+    std::ostringstream os;
+    FormatResult(channel, os);
+    for (auto& waiter : channel.waiters) {
+        completions.emplace_back(std::move(waiter.done), os.str());
+    }
+    channel.waiters.clear();
+}
+
+void MultimeterCore::ExpireWaiter(size_t channel_index, uint64_t waiter_id) {
+    auto& waiters = channels[channel_index].waiters;
+    auto it = std::find_if(waiters.begin(), waiters.end(),
+                           [waiter_id](const ResultWaiter& waiter) { return waiter.id == waiter_id; });
+    if (it != waiters.end()) {
+        completions.emplace_back(std::move(it->done), "fail, timeout\r");
+        waiters.erase(it);
+    }
+}
+
+// get_result channelN, avg=T - среднее, минимум и максимум за последние T (100ms, 2s; без единиц - мс)
+// get_result channelN, decimate=N - то же по последним N значениям
+void MultimeterCore::GetAggregate(const std::string& channel_par, const std::string& window_par, std::ostream& os) {
+    bool by_time = window_par.compare(0, 4, "avg=") == 0;
+    bool by_count = window_par.compare(0, 9, "decimate=") == 0;
+    if (!by_time && !by_count) {
+        os << "fail, " << window_par << "\r";
+        return;
+    }
+    std::string number = window_par.substr(by_time ? 4 : 9);
+    // Не больше WINDOW_DIGITS_MAX цифр и без знака: std::stoul принимает "-5" и большие числа,
+    // а окно потом переводится в наносекунды std::chrono со знаковым представлением
+    size_t digits = std::min(number.find_first_not_of("0123456789"), number.size());
+    if (digits == 0 || digits > WINDOW_DIGITS_MAX) {
+        os << "fail, " << window_par << "\r";
+        return;
+    }
+    size_t pos = 0;
+    unsigned long amount = std::stoul(number, &pos);
+    std::string unit = number.substr(pos);
+    if (amount == 0 || (by_time && unit != "" && unit != "ms" && unit != "s") || (by_count && unit != "")) {
+        os << "fail, " << window_par << "\r";
+        return;
+    }
+    std::chrono::milliseconds window(unit == "s" ? amount * 1000 : amount);
+
+    InstrumentedLock lock(mtx, "GetAggregate");
+    auto it = FindChannelByName(channel_par);
+    if (it == channels.end() || it->state != measure_state) {
+        os << "fail\r";
+        return;
+    }
+    // Окно не может быть больше, чем покрывает хранимая история
+    bool too_long = by_time ? window > config.sample_period * it->history.Capacity() : amount > it->history.Capacity();
+    if (too_long) {
+        os << "fail, " << window_par << "\r";
+        return;
+    }
+    SampleAggregate aggregate;
+    if (by_time) {
+        aggregate = it->history.Since(NowLocked() - window);
+    } else {
+        aggregate = it->history.Last(amount);
+    }
+    if (aggregate.count == 0) {
+        os << "fail\r";
+        return;
+    }
+    os << "ok, " << static_cast<float>(aggregate.Mean()) << ", " << aggregate.min << ", " << aggregate.max
+       << ", " << aggregate.count << "\r";
+}
+
+// lock_stats - статистика блокировки ядра по местам захвата, lock_stats reset - сбросить статистику
+void MultimeterCore::LockStats(const std::string& param, std::ostream& os) {
+    InstrumentedLock lock(mtx, "LockStats");
+    if (param == "reset") {
+        mtx.ResetStats();
+        os << "ok\r";
+    } else if (param.empty()) {
+        os << "ok, " << mtx.Report() << "\r";
+    } else {
+        os << "fail, " << param << "\r";
+    }
+}
+
+void MultimeterCore::AdvanceTimeCommand(const std::string& duration_par, std::ostream& os) {
+    size_t pos = 0;
+    long long ms = std::stoll(duration_par, &pos);
+    if (pos != duration_par.size() || ms < 0 || ms > ADVANCE_TIME_MAX_MS || !AdvanceTime(std::chrono::milliseconds(ms))) {
+        os << "fail, " << duration_par << "\r";
+        return;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Now().time_since_epoch());
+    os << "ok, " << elapsed.count() << "\r";
+}
+
+static std::vector<Trigger>::iterator FindSessionTrigger(Channel& channel, const std::shared_ptr<ClientSession>& session) {
+    return std::find_if(channel.triggers.begin(), channel.triggers.end(),
+                        [&session](const Trigger& trigger) { return trigger.session.lock() == session; });
+}
+
+// set_trigger channelN, above|below, value[, capture=K] - у каждого клиента не более одного триггера на канал
+void MultimeterCore::SetTrigger(const std::string& channel_par, const std::vector<std::string>& args,
+                                const std::shared_ptr<ClientSession>& session, std::ostream& os) {
+    if (!session || args.size() < 2 || args.size() > 3 || (args[0] != "above" && args[0] != "below")) {
+        os << "fail, " << channel_par << "\r";
+        return;
+    }
+    Trigger trigger;
+    trigger.session = session;
+    trigger.above = args[0] == "above";
+    size_t pos = 0;
+    trigger.threshold = std::stof(args[1], &pos);
+    if (pos != args[1].size()) {
+        os << "fail, " << channel_par << "\r";
+        return;
+    }
+    if (args.size() == 3) {
+        if (args[2].compare(0, 8, "capture=") != 0) {
+            os << "fail, " << channel_par << "\r";
+            return;
+        }
+        trigger.capture = std::stoul(args[2].substr(8));
+        if (trigger.capture > TRIGGER_CAPTURE_MAX) {
+            os << "fail, " << channel_par << "\r";
+            return;
+        }
+    }
+
+    InstrumentedLock lock(mtx, "SetTrigger");
+    auto it = FindChannelByName(channel_par);
+    if (it == channels.end()) {
+        os << "fail, " << channel_par << "\r";
+        return;
+    }
+    auto existing = FindSessionTrigger(*it, session);
+    if (existing != it->triggers.end()) {
+        *existing = trigger;
+    } else {
+        it->triggers.push_back(trigger);
+    }
+    os << "ok, " << channel_par << ", " << args[0] << ", " << trigger.threshold << "\r";
+}
+
+void MultimeterCore::ClearTrigger(const std::string& channel_par, const std::shared_ptr<ClientSession>& session,
+                                  std::ostream& os) {
+    InstrumentedLock lock(mtx, "ClearTrigger");
+    auto it = FindChannelByName(channel_par);
+    if (!session || it == channels.end()) {
+        os << "fail, " << channel_par << "\r";
+        return;
+    }
+    auto existing = FindSessionTrigger(*it, session);
+    if (existing == it->triggers.end()) {
+        os << "fail, " << channel_par << "\r";
+        return;
+    }
+    it->triggers.erase(existing);
+    os << "ok, " << channel_par << "\r";
+}
+
 void MultimeterCore::Diagnostic(const std::string& command, const std::string& channel_par, std::ostream& os) {
-    std::lock_guard<std::mutex> lock(mtx);
+    InstrumentedLock lock(mtx, "Diagnostic");
     auto it = FindChannelByName(channel_par);
     if (it != channels.end() && it->state == error_state && command == "diagnostic") {
         it->state = idle_state;
@@ -186,14 +611,32 @@ void MultimeterCore::Diagnostic(const std::string& command, const std::string& c
     }
 }
 
-std::string MultimeterCore::ProcessCommand(const std::string& input) {
+// Разбивает строку параметров "a, b, c" на список без пробелов по краям
+static std::vector<std::string> SplitParams(const std::string& params) {
+    std::vector<std::string> result;
+    std::istringstream iss(params);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if (!item.empty()) {
+            result.push_back(item);
+        }
+    }
+    return result;
+}
+
+void MultimeterCore::ProcessCommandAsync(const std::string& input, const std::shared_ptr<ClientSession>& session,
+                                         ReplyCallback done) {
     std::istringstream iss(input);
     std::string command, channel_par, range_par;
+    std::vector<std::string> args; // Дополнительные параметры после канала: "command channelN, arg1, arg2"
+    TraceSpan parse_span("parse");
     iss >> command;
 
-    // Специальная обработка для set_range в формате "set_range channelX, rangeY"
+    // Специальная обработка для set_range в формате "set_range channelX, rangeY" или "set_range channelX, auto"
     if (command == "set_range") {
-        std::regex set_range_format(R"(^channel\d+,\srange[0-3]$)");
+        std::regex set_range_format(R"(^channel\d+,\s(range[0-3]|auto)$)");
         std::string params;
         std::getline(iss, params); // Читаем всё после "set_range"
 
@@ -202,30 +645,42 @@ std::string MultimeterCore::ProcessCommand(const std::string& input) {
         params.erase(params.find_last_not_of(" \t") + 1);
         // Проверяем, что параметры не пустые
         if (params.empty()) {
-            std::ostringstream os;
-            os << "fail, no parameters\r";
-            return os.str();
+            done("fail, no parameters\r");
+            return;
         }
         size_t comma_pos = params.find(',');
         if (comma_pos == std::string::npos) {
-            std::ostringstream os;
-            os << "fail, invalid format\r";
-            return os.str();
+            done("fail, invalid format\r");
+            return;
         }
         channel_par = params.substr(0, comma_pos);
         range_par = params.substr(comma_pos + 2); // +2 чтобы пропустить ", "
         if (!std::regex_match(params, set_range_format)) {
-            std::ostringstream os;
-            os << "fail, " << range_par << "\r";
-            return os.str();
+            done("fail, " + range_par + "\r");
+            return;
         }
-    } else { iss >> channel_par; } // Для других команд просто добавляется имя канала
+    } else {
+        iss >> channel_par; // Для других команд просто добавляется имя канала
+        std::string rest;
+        std::getline(iss, rest);
+        args = SplitParams(rest);
+        if (!args.empty() && !channel_par.empty() && channel_par.back() == ',') {
+            channel_par.pop_back();
+        }
+    }
 
+    parse_span.End();
     std::ostringstream response_stream;
+    bool deferred = false; // Ответ будет передан в done позже
+    TraceSpan handler_span("handler");
 
     try {
 
-        if (command == "start_measure") {
+        // Дополнительные параметры после канала принимают только get_result и set_trigger
+        if (!args.empty() && command != "get_result" && command != "set_trigger") {
+            response_stream << "fail, too many parameters\r";
+        }
+        else if (command == "start_measure") {
             if (!isValidChannel(channel_par)) {
                 response_stream << "fail\r";
             } else {
@@ -252,8 +707,14 @@ std::string MultimeterCore::ProcessCommand(const std::string& input) {
         else if (command == "get_result") {
             if (!isValidChannel(channel_par)) {
                 response_stream << "fail\r";
-            } else {
+            } else if (args.empty()) {
                 GetResult(channel_par, response_stream);
+            } else if (args[0].compare(0, 6, "after=") == 0) {
+                deferred = WaitResult(channel_par, args, done, response_stream);
+            } else if (args.size() == 1) {
+                GetAggregate(channel_par, args[0], response_stream);
+            } else {
+                response_stream << "fail\r";
             }
         }
         else if (command == "diagnostic") {
@@ -263,6 +724,26 @@ std::string MultimeterCore::ProcessCommand(const std::string& input) {
                 Diagnostic(command, channel_par, response_stream);
             }
         }
+        else if (command == "set_trigger") {
+            if (!isValidChannel(channel_par)) {
+                response_stream << "fail\r";
+            } else {
+                SetTrigger(channel_par, args, session, response_stream);
+            }
+        }
+        else if (command == "clear_trigger") {
+            if (!isValidChannel(channel_par)) {
+                response_stream << "fail\r";
+            } else {
+                ClearTrigger(channel_par, session, response_stream);
+            }
+        }
+        else if (command == "lock_stats") {
+            LockStats(channel_par, response_stream);
+        }
+        else if (command == "advance_time") {
+            AdvanceTimeCommand(channel_par, response_stream);
+        }
         else {
             response_stream << "fail, unknown command\r";
         }
@@ -271,6 +752,10 @@ std::string MultimeterCore::ProcessCommand(const std::string& input) {
     } catch (...) {
         response_stream << "fail, unknown error\r";
     }
+    handler_span.End();
+    if (deferred) {
+        return;
+    }
 
-    return response_stream.str();
+    done(response_stream.str());
 }
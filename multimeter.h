@@ -13,9 +13,32 @@
 #include <mutex>
 #include <utility>
 #include <iomanip>
+#include <array>
+#include <cmath>
+#include <cctype>
+#include <queue>
+#include <condition_variable>
+#include <memory>
+#include <functional>
+#include "philox.h"
+#include "sample_history.h"
+#include "instrumented_mutex.h"
 
 const size_t MAX_CHANNELS = MULTIMETER_CHANNELS;
 
+using SimClock = std::chrono::steady_clock;
+
+// Параметры ядра мультиметра
+struct MultimeterConfig {
+    // Режим симуляции: время виртуальное и идёт только через AdvanceTime,
+    // фоновый поток не запускается, результат полностью определяется зерном
+    bool simulation = false;
+    uint64_t seed = 0; // Зерно ГПСЧ, 0 - случайное зерно от std::random_device
+    std::chrono::milliseconds sample_period = std::chrono::seconds(1); // Период обновления значений каналов
+    int cpu = -1; // Ядро процессора для потока таймера, -1 - без привязки
+    std::string device_name; // Имя устройства в событиях ("dev3"), пусто - сервер с одним устройством
+};
+
 enum ChannelState {
     error_state,
     idle_state,
@@ -30,47 +53,254 @@ enum Ranges {
     range3
 };
 
+// Клиент, от имени которого выполняется команда. Через notify ядро присылает
+// клиенту асинхронные события (например, срабатывание триггера).
+struct ClientSession {
+    std::function<void(const std::string&)> notify;
+};
+
+// Триггер порога: срабатывает, когда значение канала пересекает порог в заданную сторону
+struct Trigger {
+    std::weak_ptr<ClientSession> session;
+    bool above = true;          // above - значение стало >= порога, below - стало <= порога
+    float threshold = 0.0f;
+    bool armed = true;          // Повторно взводится, когда условие перестаёт выполняться
+    size_t capture = 0;         // Сколько значений до и после срабатывания прислать
+    size_t post_remaining = 0;  // Сколько значений после срабатывания ещё нужно собрать
+    std::vector<float> captured;
+};
+
+// Границы диапазонов [нижняя, верхняя) в вольтах, индекс - Ranges
+constexpr std::array<std::pair<float, float>, 4> RANGE_LIMITS = {{
+    {0.0000001f, 0.001f},
+    {0.001f, 1.0f},
+    {1.0f, 1000.0f},
+    {1000.0f, 1000000.0f}
+}};
+
+using ReplyCallback = std::function<void(const std::string&)>;
+
+// Отложенный get_result channelN, after=SEQ: ждёт значения с номером больше after
+struct ResultWaiter {
+    uint64_t id;
+    uint64_t after;
+    ReplyCallback done;
+};
+
 struct Channel {
     std::string name;
     ChannelState state = idle_state;
     Ranges range = range0;
-    std::map<Ranges, std::pair<float, float>> ranges_voltage = {
-        {range0, {0.0000001f, 0.001f}},
-        {range1, {0.001f, 1.0f}},
-        {range2, {1.0f, 1000.0f}},
-        {range3, {1000.0f, 1000000.0f}}
-    };
     float current_value = 0.0f;
+    uint64_t sample_seq = 0;           // Номер текущего значения, растёт с каждым новым значением
+    SimClock::time_point sample_time;  // Время получения текущего значения
+    std::vector<ResultWaiter> waiters; // Ожидающие нового значения запросы
+    bool auto_range = false;     // Диапазон выбирается ядром по измеренным значениям
+    float input_log10 = 0.0f;    // Входной сигнал в режиме автодиапазона, log10(В)
+    int under_range_samples = 0; // Число подряд идущих значений ниже диапазона
+    std::vector<Trigger> triggers;
+    SampleHistory history; // Последние значения канала для усреднения и захвата триггером
+    Philox4x32 rng; // Собственный генератор канала, ключ - (зерно, номер канала)
+};
+
+// Номер канала из имени "channelN" без ведущих нулей; SIZE_MAX, если имя некорректно
+constexpr size_t ParseChannelIndex(const char* name, size_t length) {
+    const char prefix[] = "channel";
+    const size_t prefix_length = sizeof(prefix) - 1;
+    if (length <= prefix_length || length > prefix_length + 9 || (name[prefix_length] == '0' && length > prefix_length + 1)) {
+        return SIZE_MAX;
+    }
+    for (size_t i = 0; i < prefix_length; ++i) {
+        if (name[i] != prefix[i]) {
+            return SIZE_MAX;
+        }
+    }
+    size_t index = 0;
+    for (size_t i = prefix_length; i < length; ++i) {
+        if (name[i] < '0' || name[i] > '9') {
+            return SIZE_MAX;
+        }
+        index = index * 10 + static_cast<size_t>(name[i] - '0');
+    }
+    return index;
+}
+
+inline size_t ParseChannelIndex(const std::string& name) {
+    return ParseChannelIndex(name.data(), name.size());
+}
+
+struct ChannelName {
+    char text[24];
+};
+
+// Имена "channel0" ... "channel(N-1)", вычисленные на этапе компиляции
+template <size_t N>
+constexpr std::array<ChannelName, N> MakeChannelNames() {
+    std::array<ChannelName, N> names{};
+    for (size_t i = 0; i < N; ++i) {
+        const char prefix[] = "channel";
+        size_t length = 0;
+        for (; prefix[length] != '\0'; ++length) {
+            names[i].text[length] = prefix[length];
+        }
+        char digits[20] = {};
+        size_t count = 0;
+        size_t value = i;
+        do {
+            digits[count++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        while (count != 0) {
+            names[i].text[length++] = digits[--count];
+        }
+    }
+    return names;
+}
+
+// Таблица каналов фиксированного размера: число каналов - параметр шаблона, хранение - std::array,
+// имена берутся из таблицы времени компиляции, а поиск канала - разбор номера из имени вместо
+// сравнения строк. Выбирается при сборке с -DMULTIMETER_FIXED_CHANNELS.
+template <size_t N>
+class FixedChannelTable {
+public:
+    static constexpr std::array<ChannelName, N> NAMES = MakeChannelNames<N>();
+
+    FixedChannelTable() {
+        for (size_t i = 0; i < N; ++i) {
+            channels_[i].name = NAMES[i].text;
+        }
+    }
+
+    static constexpr size_t size() { return N; }
+    Channel& operator[](size_t index) { return channels_[index]; }
+    Channel* begin() { return channels_.data(); }
+    Channel* end() { return channels_.data() + N; }
+
+    Channel* Find(const std::string& name) {
+        size_t index = ParseChannelIndex(name);
+        return index < N ? &channels_[index] : end();
+    }
+
+private:
+    std::array<Channel, N> channels_;
+};
+
+// Таблица каналов с размером, заданным при создании (std::vector), поиск по имени
+class DynamicChannelTable {
+public:
+    explicit DynamicChannelTable(size_t count = MAX_CHANNELS) : channels_(count) {
+        for (size_t i = 0; i < count; ++i) {
+            channels_[i].name = "channel" + std::to_string(i);
+        }
+    }
+
+    size_t size() const { return channels_.size(); }
+    Channel& operator[](size_t index) { return channels_[index]; }
+    Channel* begin() { return channels_.data(); }
+    Channel* end() { return channels_.data() + channels_.size(); }
+
+    Channel* Find(const std::string& name) {
+        return std::find_if(begin(), end(), [&name](const Channel& channel) { return channel.name == name; });
+    }
+
+private:
+    std::vector<Channel> channels_;
+};
+
+#ifdef MULTIMETER_FIXED_CHANNELS
+using ChannelTable = FixedChannelTable<MAX_CHANNELS>;
+#else
+using ChannelTable = DynamicChannelTable;
+#endif
+
+// Отложенные действия ядра: обновление напряжения, случайная смена состояния каналов
+// и выход канала из busy_state. Выполняются по времени в порядке (time, order).
+enum TimerEventType {
+    voltage_event,
+    state_event,
+    busy_recovery_event,
+    poll_timeout_event
+};
+
+struct TimerEvent {
+    SimClock::time_point time;
+    uint64_t order;
+    TimerEventType type;
+    size_t channel;  // Для busy_recovery_event и poll_timeout_event
+    uint64_t waiter; // Для poll_timeout_event
+    bool operator>(const TimerEvent& other) const {
+        return time != other.time ? time > other.time : order > other.order;
+    }
 };
 
 class MultimeterCore {
 public:
-    MultimeterCore();
+    explicit MultimeterCore(const MultimeterConfig& config = MultimeterConfig());
     ~MultimeterCore();
 
     void ChannelsInit();
-    void RandomizeVoltage();
-    void RandomizeChannelState();
     std::string ChannelStateToString(ChannelState state);
-    std::string ProcessCommand(const std::string& input);
+    // Выполняет команду и передаёт ответ в done - сразу или позже, из потока таймера
+    // (get_result с after= ждёт нового значения, не занимая вызывающий поток). Отложенный
+    // done вызывается без mtx, но в потоке таймера, поэтому не должен блокироваться:
+    // сервер только ставит ответ в неблокирующую очередь вывода соединения.
+    void ProcessCommandAsync(const std::string& input, const std::shared_ptr<ClientSession>& session, ReplyCallback done);
+
+    // Текущее время ядра (виртуальное в режиме симуляции)
+    SimClock::time_point Now();
+    // Продвигает виртуальное время, выполняя все наступившие события; только в режиме симуляции
+    bool AdvanceTime(SimClock::duration duration);
 
 private:
-    std::vector<Channel> channels;
-    std::random_device rd;
-    std::mt19937 gen;
-    volatile bool running = true;
+    const MultimeterConfig config;
+    ChannelTable channels;
+    const uint64_t seed;
+    Philox4x32 schedule_rng; // Интервалы проверки состояния, поток с номером MAX_CHANNELS
+    bool running = true;
     size_t current_channel_count = 0;
-    std::thread voltage_thread;
-    std::thread state_thread;
-    std::mutex mtx;
+    std::thread timer_thread;
+    InstrumentedMutex mtx; // Общая блокировка ядра; статистика захватов - команда lock_stats
+    std::condition_variable_any timer_cv;
+    std::priority_queue<TimerEvent, std::vector<TimerEvent>, std::greater<TimerEvent>> events;
+    uint64_t event_order = 0;
+    SimClock::time_point virtual_now; // Виртуальное время (режим симуляции)
+    // События для клиентов, накопленные под mtx; отправляются после его освобождения
+    std::vector<std::pair<std::shared_ptr<ClientSession>, std::string>> notifications;
+    std::vector<std::pair<ReplyCallback, std::string>> completions; // Ответы на отложенные запросы
+    uint64_t next_waiter_id = 1;
+    SimClock::time_point start_time; // Отсчёт времени значений в ответах get_result
+
+    // Вызываются с захваченным mtx
+    SimClock::time_point NowLocked() const;
+    void Schedule(SimClock::duration delay, TimerEventType type, size_t channel = 0, uint64_t waiter = 0);
+    void RunDueEvents(SimClock::time_point until);
+    void RandomizeVoltage();
+    void MeasureAutoRange(Channel& channel);
+    void EvaluateTriggers(Channel& channel);
+    void CompleteWaiters(Channel& channel);
+    void ExpireWaiter(size_t channel_index, uint64_t waiter_id);
+    void FormatResult(const Channel& channel, std::ostream& os) const;
+    std::string ChannelLabel(const Channel& channel) const;
+    void DeliverNotifications(InstrumentedLock& lock);
+    void RandomizeChannelState();
+    void TimerLoop();
 
     bool isValidChannel(const std::string& channel) const;
     bool isValidRange(const std::string& range) const;
-    std::vector<Channel>::iterator FindChannelByName(const std::string& channel_par);
+    Channel* FindChannelByName(const std::string& channel_par);
     void StartMeasure(const std::string& channel_par, std::ostream& os);
     void SetRange(const std::string& channel_par, const std::string& range_par, std::ostream& os);
     void StopMeasure(const std::string& channel_par, std::ostream& os);
     void GetStatus(const std::string& channel_par, std::ostream& os);
     void GetResult(const std::string& channel_par, std::ostream& os);
+    // Возвращает true, если ответ будет передан в done позже
+    bool WaitResult(const std::string& channel_par, const std::vector<std::string>& args, const ReplyCallback& done,
+                    std::ostream& os);
+    void GetAggregate(const std::string& channel_par, const std::string& window_par, std::ostream& os);
     void Diagnostic(const std::string& command, const std::string& channel_par, std::ostream& os);
+    void AdvanceTimeCommand(const std::string& duration_par, std::ostream& os);
+    void LockStats(const std::string& param, std::ostream& os);
+    void SetTrigger(const std::string& channel_par, const std::vector<std::string>& args,
+                    const std::shared_ptr<ClientSession>& session, std::ostream& os);
+    void ClearTrigger(const std::string& channel_par, const std::shared_ptr<ClientSession>& session, std::ostream& os);
 };
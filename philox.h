@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+
+// Счётчиковый генератор Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+// Очередное число - это функция от (ключ, счётчик), поэтому у каждого канала свой независимый
+// поток чисел без общего состояния, а результат не зависит от порядка работы потоков.
+// Удовлетворяет требованиям UniformRandomBitGenerator.
+class Philox4x32 {
+public:
+    using result_type = uint32_t;
+
+    Philox4x32() : Philox4x32(0, 0) {}
+    // seed - общее зерно, stream - номер независимого потока (например, номер канала)
+    Philox4x32(uint64_t seed, uint64_t stream)
+        : key_{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)},
+          counter_{0, 0, static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32)} {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() {
+        if (index_ == 4) {
+            Generate();
+            index_ = 0;
+        }
+        return output_[index_++];
+    }
+
+    // Равномерное число в [lo, hi); не зависит от реализации std::uniform_real_distribution
+    float UniformFloat(float lo, float hi) {
+        float unit = static_cast<float>((*this)() >> 8) * (1.0f / 16777216.0f);
+        float value = lo + (hi - lo) * unit;
+        return value < hi ? value : lo;
+    }
+
+    // Равномерное целое в [lo, hi]
+    int UniformInt(int lo, int hi) {
+        return lo + static_cast<int>((*this)() % static_cast<uint32_t>(hi - lo + 1));
+    }
+
+private:
+    uint32_t key_[2];
+    uint32_t counter_[4];
+    uint32_t output_[4] = {0, 0, 0, 0};
+    int index_ = 4;
+
+    static void MulHiLo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+        uint64_t product = static_cast<uint64_t>(a) * b;
+        hi = static_cast<uint32_t>(product >> 32);
+        lo = static_cast<uint32_t>(product);
+    }
+
+    void Generate() {
+        uint32_t x[4] = {counter_[0], counter_[1], counter_[2], counter_[3]};
+        uint32_t k0 = key_[0];
+        uint32_t k1 = key_[1];
+        for (int round = 0; round < 10; ++round) {
+            uint32_t hi0, lo0, hi1, lo1;
+            MulHiLo(0xD2511F53u, x[0], hi0, lo0);
+            MulHiLo(0xCD9E8D57u, x[2], hi1, lo1);
+            uint32_t y[4] = {hi1 ^ x[1] ^ k0, lo1, hi0 ^ x[3] ^ k1, lo0};
+            x[0] = y[0]; x[1] = y[1]; x[2] = y[2]; x[3] = y[3];
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        output_[0] = x[0]; output_[1] = x[1]; output_[2] = x[2]; output_[3] = x[3];
+        // 64-битный счётчик блоков в младших словах
+        if (++counter_[0] == 0) {
+            ++counter_[1];
+        }
+    }
+};
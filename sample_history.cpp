@@ -0,0 +1,96 @@
+#include "sample_history.h"
+#include <algorithm>
+
+void SampleAggregate::Add(float value) {
+    if (count == 0) {
+        min = max = value;
+    } else {
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+    sum += value;
+    ++count;
+}
+
+void SampleAggregate::Merge(const SampleAggregate& other) {
+    if (other.count == 0) {
+        return;
+    }
+    if (count == 0) {
+        *this = other;
+        return;
+    }
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    sum += other.sum;
+    count += other.count;
+}
+
+SampleHistory::SampleHistory(size_t capacity)
+    : times_(capacity), values_(capacity), blocks_(capacity / BLOCK_SIZE) {}
+
+void SampleHistory::Add(TimePoint time, float value) {
+    size_t slot = total_ % values_.size();
+    times_[slot] = time;
+    values_[slot] = value;
+    SampleAggregate& block = blocks_[(total_ / BLOCK_SIZE) % blocks_.size()];
+    if (total_ % BLOCK_SIZE == 0) {
+        block = SampleAggregate(); // Блок начинается заново, старые значения уже вытеснены
+    }
+    block.Add(value);
+    ++total_;
+}
+
+size_t SampleHistory::Size() const {
+    return static_cast<size_t>(total_ - Oldest());
+}
+
+uint64_t SampleHistory::Oldest() const {
+    return total_ > values_.size() ? total_ - values_.size() : 0;
+}
+
+SampleAggregate SampleHistory::Range(uint64_t first, uint64_t last) const {
+    SampleAggregate result;
+    uint64_t i = first;
+    while (i < last && i % BLOCK_SIZE != 0) {
+        result.Add(values_[i % values_.size()]);
+        ++i;
+    }
+    while (i + BLOCK_SIZE <= last) {
+        result.Merge(blocks_[(i / BLOCK_SIZE) % blocks_.size()]);
+        i += BLOCK_SIZE;
+    }
+    while (i < last) {
+        result.Add(values_[i % values_.size()]);
+        ++i;
+    }
+    return result;
+}
+
+SampleAggregate SampleHistory::Last(size_t count) const {
+    uint64_t first = total_ - std::min<uint64_t>(count, Size());
+    return Range(first, total_);
+}
+
+SampleAggregate SampleHistory::Since(TimePoint from) const {
+    // Время значений не убывает - ищем первое значение позже from двоичным поиском
+    uint64_t lo = Oldest();
+    uint64_t hi = total_;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (times_[mid % times_.size()] > from) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return Range(lo, total_);
+}
+
+std::vector<float> SampleHistory::LastValues(size_t count) const {
+    std::vector<float> result;
+    for (uint64_t i = total_ - std::min<uint64_t>(count, Size()); i < total_; ++i) {
+        result.push_back(values_[i % values_.size()]);
+    }
+    return result;
+}
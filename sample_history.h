@@ -0,0 +1,50 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Сводка по группе значений канала
+struct SampleAggregate {
+    size_t count = 0;
+    double sum = 0.0;
+    float min = 0.0f;
+    float max = 0.0f;
+
+    void Add(float value);
+    void Merge(const SampleAggregate& other);
+    double Mean() const { return count ? sum / count : 0.0; }
+};
+
+// История последних значений канала (кольцевой буфер) с агрегатами по блокам
+// из BLOCK_SIZE значений. Запрос по окну складывает готовые агрегаты целых блоков
+// и досчитывает только неполные блоки на краях, не перебирая всё окно.
+class SampleHistory {
+public:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    static const size_t BLOCK_SIZE = 32;
+    static const size_t DEFAULT_CAPACITY = 1024; // Должна быть кратна BLOCK_SIZE
+
+    explicit SampleHistory(size_t capacity = DEFAULT_CAPACITY);
+
+    void Add(TimePoint time, float value);
+    size_t Size() const;
+    size_t Capacity() const { return values_.size(); }
+    // Агрегат по последним count значениям (или по всем сохранённым, если их меньше)
+    SampleAggregate Last(size_t count) const;
+    // Агрегат по значениям, полученным строго позже from
+    SampleAggregate Since(TimePoint from) const;
+    // Последние count значений в порядке поступления
+    std::vector<float> LastValues(size_t count) const;
+
+private:
+    std::vector<TimePoint> times_;
+    std::vector<float> values_;
+    std::vector<SampleAggregate> blocks_;
+    uint64_t total_ = 0; // Сколько значений добавлено за всё время; номер следующего значения
+
+    uint64_t Oldest() const;
+    // Агрегат по значениям с номерами [first, last)
+    SampleAggregate Range(uint64_t first, uint64_t last) const;
+};
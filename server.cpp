@@ -1,7 +1,21 @@
 // server.cpp
 #include "server.h"
+#include "affinity.h"
 #include <string.h> // Для strerror
 #include <ctime>    // Для времени в логах
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <vector>
+#include <sstream>
+
+static const size_t MAX_COMMAND_LENGTH = 1024;
+static const size_t MAX_DEVICE_DIGITS = 9; // Цифр в номере устройства "devK/"
+static const size_t MAX_OUTPUT_BACKLOG = 256 * 1024; // Неотправленных байт на клиента до разрыва соединения
+static const size_t MAX_EVENT_BACKLOG = 64 * 1024;   // Сверх этого события клиенту не ставятся в очередь
+static const char OVERLOADED_REPLY[] = "fail, overloaded\r";
+static const std::string TRACE_DIR_PREFIX = "/tmp/multimeter-traces-"; // + uid сервера
+static const char* const PRIORITY_NAMES[PRIORITY_CLASSES] = {"control", "bulk"};
 
 std::string CurrentTime() {
     std::time_t now = std::time(nullptr);
@@ -10,7 +24,157 @@ std::string CurrentTime() {
     return buf;
 }
 
-Server::Server(MultimeterCore& core) : core_(core) {}
+ClientConnection::ClientConnection(uint64_t id, int fd, int wake_fd) : id_(id), fd_(fd), wake_fd_(wake_fd) {}
+
+ClientConnection::~ClientConnection() {
+    close(fd_);
+}
+
+void ClientConnection::Complete(uint64_t request, const std::string& reply) {
+    std::lock_guard<std::mutex> lock(write_mtx_);
+    ready_[request] = reply;
+    std::string batch;
+    for (auto it = ready_.find(next_reply_); it != ready_.end(); it = ready_.find(next_reply_)) {
+        batch += it->second;
+        ready_.erase(it);
+        ++next_reply_;
+    }
+    if (!batch.empty()) {
+        Enqueue(batch);
+    }
+}
+
+// Событие ставится в очередь вывода целиком: строки событий и ответов не перемешиваются,
+// а поток таймера ядра не блокируется на клиенте, который не читает сокет
+void ClientConnection::SendEvent(const std::string& event) {
+    std::lock_guard<std::mutex> lock(write_mtx_);
+    if (broken_ || output_.size() + event.size() > MAX_EVENT_BACKLOG) {
+        return; // Клиент не успевает читать - событие теряется, соединение остаётся
+    }
+    Enqueue(event);
+}
+
+void ClientConnection::Flush() {
+    std::lock_guard<std::mutex> lock(write_mtx_);
+    if (!broken_) {
+        FlushLocked();
+    }
+}
+
+bool ClientConnection::HasPendingOutput() {
+    std::lock_guard<std::mutex> lock(write_mtx_);
+    return !broken_ && !output_.empty();
+}
+
+void ClientConnection::Enqueue(const std::string& data) {
+    if (broken_) {
+        return; // Дальнейшие ответы этому клиенту не отправляем
+    }
+    if (output_.size() + data.size() > MAX_OUTPUT_BACKLOG) {
+        std::cout << "[" << CurrentTime() << "] Клиент " << fd_ << " не читает ответы, соединение разорвано." << std::endl;
+        Drop();
+        return;
+    }
+    bool was_empty = output_.empty();
+    output_ += data;
+    if (was_empty) {
+        FlushLocked();
+        if (!output_.empty() && !broken_) {
+            // Остаток досылает поток ввода-вывода, когда сокет станет доступен для записи
+            char wake = 0;
+            (void)!write(wake_fd_, &wake, 1);
+        }
+    }
+}
+
+void ClientConnection::FlushLocked() {
+    size_t sent = 0;
+    while (sent < output_.size()) {
+        ssize_t n = send(fd_, output_.data() + sent, output_.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { break; }
+            perror("write");
+            Drop();
+            return;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    output_.erase(0, sent);
+}
+
+// Поток ввода-вывода увидит закрытие сокета при следующем чтении и удалит клиента
+void ClientConnection::Drop() {
+    broken_ = true;
+    output_.clear();
+    ready_.clear();
+    shutdown(fd_, SHUT_RDWR);
+}
+
+bool RateLimiter::TryAcquire() {
+    if (rate <= 0.0) {
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - last).count();
+    last = now;
+    // Запас не меньше одной команды, иначе при дробном лимите (0.5 команды в секунду)
+    // корзина никогда не наберёт целый маркер
+    tokens = std::min(std::max(1.0, rate), tokens + elapsed * rate);
+    if (tokens < 1.0) {
+        return false;
+    }
+    tokens -= 1.0;
+    return true;
+}
+
+Server::Server(const std::vector<MultimeterCore*>& devices, const ServerConfig& config)
+    : devices_(devices), config_(config) {
+    Tracer::Instance().SetSampleRate(config_.trace_sample);
+    for (size_t i = 0; i < PRIORITY_CLASSES; ++i) {
+        limiters_[i].rate = config_.rate_limit[i];
+        limiters_[i].tokens = std::max(1.0, config_.rate_limit[i]);
+        limiters_[i].last = std::chrono::steady_clock::now();
+    }
+    size_t shard_count = std::max<size_t>(1, std::min(config_.shard_count, devices_.size()));
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards_.push_back({std::make_unique<WorkerPool>(config_.worker_count, config_.queue_limit,
+                                                        config_.pin_cpus ? ShardCpu(i) : -1)});
+    }
+}
+
+int Server::ShardCpu(size_t shard) {
+    static const std::vector<int> cpus = AllowedCpus();
+    return cpus.size() > 1 ? cpus[shard % cpus.size()] : -1;
+}
+
+void Server::RouteCommand(const std::string& command, size_t& device, std::string& routed) {
+    device = 0;
+    routed = command;
+    // Устройство указывается префиксом "devK/" у первого параметра команды
+    size_t param = command.find(' ');
+    if (param == std::string::npos || command.compare(param + 1, 3, "dev") != 0) {
+        return;
+    }
+    size_t slash = command.find('/', param + 1);
+    if (slash == std::string::npos || slash > command.find_first_of(" ,", param + 1)) {
+        return; // Не префикс устройства - передаём команду как есть
+    }
+    // Номер разбирается без исключений и с ограничением длины: поток ввода-вывода
+    // не должен падать на "dev99999999999999999999/..."
+    device = SIZE_MAX;
+    size_t digits = param + 4;
+    if (slash == digits || slash - digits > MAX_DEVICE_DIGITS ||
+        command.find_first_not_of("0123456789", digits) != slash) {
+        return;
+    }
+    size_t index = 0;
+    for (size_t i = digits; i < slash; ++i) {
+        index = index * 10 + static_cast<size_t>(command[i] - '0');
+    }
+    device = index;
+    routed = command.substr(0, param + 1) + command.substr(slash + 1);
+}
 
 void Server::Run() {
     int server_fd;
@@ -30,55 +194,322 @@ void Server::Run() {
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_fd, 5) == -1) {
+    if (listen(server_fd, SOMAXCONN) == -1) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
 
-    std::cout << "[" << CurrentTime() << "] Сервер запущен. Ожидание подключений на " << socket_path_ << std::endl;
+    std::cout << "[" << CurrentTime() << "] Сервер запущен. Ожидание подключений на " << socket_path_
+              << " (устройств: " << devices_.size() << ", шардов: " << shards_.size()
+              << ", рабочих потоков на шард: " << config_.worker_count << ", очередь: " << config_.queue_limit
+              << ", клиентов: " << config_.max_clients << ")" << std::endl;
 
+    if (pipe2(wake_fds_, O_NONBLOCK | O_CLOEXEC) == -1) {
+        perror("pipe2");
+        exit(EXIT_FAILURE);
+    }
+
+    // Единственный поток ввода-вывода: принимает подключения, читает команды и досылает
+    // ответы, которые сокет не принял сразу, а выполняются команды в пуле рабочих потоков
+    Tracer::Instance().SetThreadName("io");
+    std::vector<pollfd> fds;
     while (true) {
-        int client_fd = accept(server_fd, nullptr, nullptr);
-        if (client_fd == -1) {
-            perror("accept");
-            continue;
+        fds.clear();
+        fds.push_back({server_fd, POLLIN, 0});
+        fds.push_back({wake_fds_[0], POLLIN, 0});
+        for (const auto& entry : clients_) {
+            short events = POLLIN;
+            if (entry.second->HasPendingOutput()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({entry.first, events, 0});
         }
 
-        std::cout << "[" << CurrentTime() << "] Новый клиент подключен. FD: " << client_fd << std::endl;
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) { continue; }
+            perror("poll");
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char drain[256];
+            while (read(wake_fds_[0], drain, sizeof(drain)) > 0) {
+            }
+        }
 
-        // Запускаем обработку клиента в отдельном потоке
-        std::thread([this, client_fd]() { this->HandleClient(client_fd); }).detach();
+        for (size_t i = 2; i < fds.size(); ++i) {
+            if (fds[i].revents == 0) { continue; }
+            auto it = clients_.find(fds[i].fd);
+            if (fds[i].revents & POLLOUT) {
+                it->second->Flush();
+            }
+            if ((fds[i].revents & ~POLLOUT) != 0 && !ReadClient(it->second)) {
+                std::cout << "[" << CurrentTime() << "] Клиент " << it->first << " отключился." << std::endl;
+                clients_.erase(it); // Сокет закроется, когда завершатся команды клиента
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            AcceptClient(server_fd);
+        }
     }
     close(server_fd); // Закрываем серверный сокет при выходе из цикла
+    close(wake_fds_[0]);
+    close(wake_fds_[1]);
 }
 
-void Server::HandleClient(int client_fd) {
-    char buffer[1024];
-    while (true) {
-        int bytes_read = read(client_fd, buffer, sizeof(buffer));
-        if (bytes_read <= 0) {
-            std::cout << "[" << CurrentTime() << "] Клиент " << client_fd << " отключился." << std::endl;
-            break;
+void Server::AcceptClient(int server_fd) {
+    TraceSpan accept_span("accept", Tracer::Instance().SampleRequest());
+    int client_fd = accept(server_fd, nullptr, nullptr);
+    if (client_fd == -1) {
+        perror("accept");
+        return;
+    }
+
+    if (clients_.size() >= config_.max_clients) {
+        std::cout << "[" << CurrentTime() << "] Отказ в подключении: превышен лимит клиентов." << std::endl;
+        (void)!send(client_fd, OVERLOADED_REPLY, sizeof(OVERLOADED_REPLY) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(client_fd);
+        return;
+    }
+
+    auto client = std::make_shared<ClientConnection>(next_client_id_++, client_fd, wake_fds_[1]);
+    client->max_priority = ClassifyPeer(client_fd);
+    client->priority = client->max_priority;
+    std::cout << "[" << CurrentTime() << "] Новый клиент подключен. FD: " << client_fd
+              << ", класс: " << PRIORITY_NAMES[client->priority] << std::endl;
+    std::weak_ptr<ClientConnection> weak_client = client;
+    client->session = std::make_shared<ClientSession>();
+    client->session->notify = [weak_client](const std::string& event) {
+        if (auto connection = weak_client.lock()) {
+            connection->SendEvent(event);
         }
+    };
+    clients_[client_fd] = client;
+}
 
-        std::string command(buffer, bytes_read);
-        // Удаляем лишние символы (CR/LF) если они есть
-        command.erase(std::remove(command.begin(), command.end(), '\r'), command.end());
-        command.erase(std::remove(command.begin(), command.end(), '\n'), command.end());
+PriorityClass Server::ClassifyPeer(int client_fd) const {
+    if (config_.control_uid < 0 && config_.control_gid < 0) {
+        return control_priority;
+    }
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+        perror("getsockopt");
+        return bulk_priority;
+    }
+    bool control = (config_.control_uid >= 0 && cred.uid == static_cast<uid_t>(config_.control_uid)) ||
+                   (config_.control_gid >= 0 && cred.gid == static_cast<gid_t>(config_.control_gid));
+    return control ? control_priority : bulk_priority;
+}
 
+std::string Server::Hello(const std::shared_ptr<ClientConnection>& client, const std::string& command) {
+    std::istringstream iss(command);
+    std::string name, param;
+    iss >> name >> param;
+    for (size_t i = 0; i < PRIORITY_CLASSES; ++i) {
+        if (param == std::string("priority=") + PRIORITY_NAMES[i]) {
+            if (static_cast<PriorityClass>(i) < client->max_priority) {
+                break; // Повышение класса сверх разрешённого учётными данными
+            }
+            client->priority = static_cast<PriorityClass>(i);
+            return "ok, " + param + "\r";
+        }
+    }
+    return "fail, " + param + "\r";
+}
+
+bool Server::ReadClient(const std::shared_ptr<ClientConnection>& client) {
+    char buffer[1024];
+    Tracer& tracer = Tracer::Instance();
+    // Решение о трассировке принимается один раз до чтения: если выборку включат во время
+    // read(), команды этого чтения не трассируются, и интервал read не начнётся с нуля часов
+    bool tracing = tracer.Enabled();
+    Tracer::Clock::time_point read_start;
+    if (tracing) {
+        read_start = Tracer::Clock::now();
+    }
+    ssize_t bytes_read = read(client->fd(), buffer, sizeof(buffer));
+    if (bytes_read <= 0) {
+        return false;
+    }
+    Tracer::Clock::time_point read_end;
+    if (tracing) {
+        read_end = Tracer::Clock::now();
+    }
+
+    // Команды разделяются CR (или LF); за одно чтение может прийти несколько команд
+    // или только часть команды
+    client->input.append(buffer, static_cast<size_t>(bytes_read));
+    size_t start = 0;
+    size_t end;
+    while ((end = client->input.find_first_of("\r\n", start)) != std::string::npos) {
+        std::string command = client->input.substr(start, end - start);
+        start = end + 1;
+        if (client->discarding) {
+            client->discarding = false; // Конец слишком длинной команды, на которую уже дан ответ
+            continue;
+        }
         // Пропускаем пустые команды
         if (command.empty()) { continue; }
+        if (command.size() > MAX_COMMAND_LENGTH) {
+            client->Complete(client->next_request++, "fail, command too long\r");
+            continue;
+        }
+        uint64_t trace = tracing ? tracer.SampleRequest() : 0;
+        if (trace != 0) {
+            tracer.Record("read", trace, read_start, read_end);
+        }
+        DispatchCommand(client, command, trace);
+    }
+    client->input.erase(0, start);
+
+    if (client->discarding) {
+        client->input.clear();
+    } else if (client->input.size() > MAX_COMMAND_LENGTH) {
+        // Одна строка - один ответ: остаток строки до CR/LF отбрасывается, а не считается новой командой
+        client->input.clear();
+        client->discarding = true;
+        client->Complete(client->next_request++, "fail, command too long\r");
+    }
+    return true;
+}
+
+bool Server::IsServerCommand(const std::string& command) {
+    std::string name = command.substr(0, command.find(' '));
+    return name == "trace_sample" || name == "trace_dump";
+}
 
-        std::cout << "[" << CurrentTime() << "] Клиент " << client_fd << " отправил команду: " << command << std::endl;
+// Каталог трассировок принадлежит серверу и закрыт для остальных (0700). Файл открывается
+// только новый (O_EXCL) и без перехода по символической ссылке (O_NOFOLLOW), поэтому
+// запись нельзя перенаправить в чужой файл через общий /tmp.
+static int OpenTraceFile(const std::string& name, std::string& path) {
+    std::string dir = TRACE_DIR_PREFIX + std::to_string(geteuid());
+    if (mkdir(dir.c_str(), 0700) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    struct stat st;
+    if (lstat(dir.c_str(), &st) == -1) {
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077) != 0) {
+        errno = EACCES; // Каталог подменён или доступен другим пользователям
+        return -1;
+    }
+    path = dir + "/" + name;
+    return open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+}
 
-        std::string response = core_.ProcessCommand(command);
+// trace_sample N - трассировать каждый N-й запрос (0 - выключить)
+// trace_dump NAME - выгрузить накопленные интервалы в файл NAME каталога трассировок в формате Chrome trace-event JSON
+std::string Server::ProcessServerCommand(const std::string& command) {
+    std::istringstream iss(command);
+    std::string name, param;
+    iss >> name >> param;
+    try {
+        if (name == "trace_sample") {
+            size_t pos = 0;
+            unsigned long every = std::stoul(param, &pos);
+            if (pos != param.size()) {
+                return "fail, " + param + "\r";
+            }
+            Tracer::Instance().SetSampleRate(static_cast<uint32_t>(every));
+            return "ok, " + std::to_string(every) + "\r";
+        }
+        // Клиент задаёт только имя файла, а не произвольный путь
+        if (name == "trace_dump" && !param.empty() && param.find('/') == std::string::npos && param[0] != '.') {
+            std::string path;
+            int fd = OpenTraceFile(param, path);
+            if (fd == -1) {
+                return "fail, " + param + ", " + strerror(errno) + "\r";
+            }
+            std::ostringstream out;
+            long count = Tracer::Instance().Dump(out);
+            std::string data = out.str();
+            size_t written = 0;
+            while (count >= 0 && written < data.size()) {
+                ssize_t n = write(fd, data.data() + written, data.size() - written);
+                if (n == -1 && errno != EINTR) {
+                    count = -1;
+                } else if (n > 0) {
+                    written += static_cast<size_t>(n);
+                }
+            }
+            close(fd);
+            if (count < 0) {
+                return "fail, " + param + "\r";
+            }
+            return "ok, " + path + ", " + std::to_string(count) + "\r";
+        }
+    } catch (const std::exception& e) {
+        return std::string("fail, exception - ") + e.what() + "\r";
+    }
+    return "fail, " + param + "\r";
+}
 
-        std::cout << "[" << CurrentTime() << "] Отправляем клиенту " << client_fd << " ответ: " << response << std::endl;
+void Server::DispatchCommand(const std::shared_ptr<ClientConnection>& client, const std::string& command, uint64_t trace) {
+    uint64_t request = client->next_request++;
 
-        if (write(client_fd, response.c_str(), response.size()) == -1) {
-            perror("write");
-            break;
+    std::cout << "[" << CurrentTime() << "] Клиент " << client->fd() << " отправил команду: " << command << std::endl;
+
+    if (command.compare(0, 6, "hello ") == 0) {
+        client->Complete(request, Hello(client, command));
+        return;
+    }
+    if (IsServerCommand(command) && client->priority != control_priority) {
+        // Трассировка общая для всего сервера - управляют ею только клиенты класса control
+        client->Complete(request, "fail, permission denied\r");
+        return;
+    }
+    if (!limiters_[client->priority].TryAcquire()) {
+        client->Complete(request, "fail, rate limited\r");
+        return;
+    }
+    PriorityClass priority = client->priority;
+
+    Tracer::Clock::time_point queued;
+    if (trace != 0) {
+        queued = Tracer::Clock::now();
+    }
+
+    if (IsServerCommand(command)) {
+        bool accepted = shards_[0].pool->TrySubmit(client->id(), [client, request, command]() {
+            client->Complete(request, ProcessServerCommand(command));
+        }, priority);
+        if (!accepted) {
+            client->Complete(request, OVERLOADED_REPLY);
         }
+        return;
+    }
+
+    size_t device;
+    std::string routed;
+    RouteCommand(command, device, routed);
+    if (device >= devices_.size()) {
+        client->Complete(request, "fail, unknown device\r");
+        return;
+    }
+    MultimeterCore* core = devices_[device];
+    WorkerPool& pool = *shards_[device % shards_.size()].pool;
+
+    // Ключ - идентификатор клиента: команды одного клиента в шарде выполняются в порядке отправки
+    bool accepted = pool.TrySubmit(client->id(), [client, request, core, routed, trace, queued]() {
+        TraceRequestScope trace_scope(trace);
+        if (trace != 0) {
+            Tracer::Instance().SetThreadName("worker");
+            Tracer::Instance().Record("queue_wait", trace, queued, Tracer::Clock::now());
+        }
+        // Долгий опрос отвечает позже из потока таймера ядра, не занимая рабочий поток
+        core->ProcessCommandAsync(routed, client->session, [client, request, trace](const std::string& response) {
+            std::cout << "[" << CurrentTime() << "] Отправляем клиенту " << client->fd() << " ответ: " << response << std::endl;
+            TraceSpan write_span("write", trace);
+            client->Complete(request, response);
+        });
+    }, priority);
+
+    if (!accepted) {
+        // Очередь переполнена: быстро отказываем, чтобы не увеличивать задержку принятых запросов
+        std::cout << "[" << CurrentTime() << "] Очередь переполнена, отказ клиенту " << client->fd() << std::endl;
+        client->Complete(request, OVERLOADED_REPLY);
     }
-    close(client_fd);
 }
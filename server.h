@@ -1,21 +1,128 @@
 #pragma once
 #include "multimeter.h"
+#include "worker_pool.h"
+#include "tracer.h"
 #include <string>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <iostream>
-#include <thread> // Для HandleClient
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <chrono>
+
+// Параметры сервера, ограничивающие потребление ресурсов
+struct ServerConfig {
+    size_t worker_count = 4;   // Число рабочих потоков в каждом шарде
+    size_t queue_limit = 256;  // Максимум команд, ожидающих обработки в каждом шарде
+    size_t shard_count = 1;    // Число шардов; устройство devK обслуживает шард K % shard_count
+    size_t max_clients = 64;   // Максимум одновременных подключений
+    bool pin_cpus = false;     // Привязывать потоки шардов к ядрам процессора (--pin)
+    uint32_t trace_sample = 0; // Трассировать каждый N-й запрос, 0 - трассировка выключена
+    // Клиенты с этим uid или gid (по SO_PEERCRED) получают класс control, остальные - bulk.
+    // Если оба -1, классы не назначаются по учётным данным: все начинают с control.
+    int control_uid = -1;
+    int control_gid = -1;
+    double rate_limit[PRIORITY_CLASSES] = {0.0, 0.0}; // Команд в секунду на класс, 0 - без ограничения
+};
+
+// Ограничение частоты команд класса приоритета (маркерная корзина с запасом в одну секунду,
+// но не меньше одной команды).
+// Используется только потоком ввода-вывода.
+struct RateLimiter {
+    double rate = 0.0;
+    double tokens = 0.0;
+    std::chrono::steady_clock::time_point last;
+
+    bool TryAcquire();
+};
+
+// Состояние клиентского соединения. Команды одного клиента могут выполняться
+// разными рабочими потоками, но ответы уходят строго в порядке поступления команд.
+// Запись в сокет неблокирующая: что не ушло сразу, копится в очереди вывода и досылается
+// потоком ввода-вывода по POLLOUT, поэтому клиент, который не читает ответы, не задерживает
+// ни рабочие потоки, ни поток ввода-вывода. Переполнение очереди разрывает соединение.
+class ClientConnection {
+public:
+    // wake_fd - сигнал потоку ввода-вывода, что у соединения появились неотправленные данные
+    ClientConnection(uint64_t id, int fd, int wake_fd);
+    ~ClientConnection();
+
+    uint64_t id() const { return id_; }
+    int fd() const { return fd_; }
+    // Регистрирует ответ на команду с номером request и отправляет все готовые ответы по порядку
+    void Complete(uint64_t request, const std::string& reply);
+    // Отправляет асинхронное событие вне очереди ответов; если клиент не успевает читать, событие теряется
+    void SendEvent(const std::string& event);
+    // Досылает очередь вывода; вызывает поток ввода-вывода по POLLOUT
+    void Flush();
+    bool HasPendingOutput();
+
+    std::shared_ptr<ClientSession> session; // Сессия клиента в ядре (триггеры и события)
+    // Поля ниже использует только поток ввода-вывода
+    std::string input;         // Недочитанный хвост команды
+    bool discarding = false;   // Пропускать ввод до конца строки (команда оказалась слишком длинной)
+    uint64_t next_request = 0; // Номер следующей принятой команды
+    PriorityClass priority = control_priority;     // Текущий класс команд клиента
+    PriorityClass max_priority = control_priority; // Высший класс, разрешённый клиенту
+
+private:
+    uint64_t id_;
+    int fd_;
+    int wake_fd_;
+    std::mutex write_mtx_;
+    uint64_t next_reply_ = 0;
+    std::map<uint64_t, std::string> ready_; // Готовые ответы, ожидающие своей очереди
+    std::string output_;                    // Данные, которые сокет ещё не принял
+    bool broken_ = false;
+
+    // Вызываются с захваченным write_mtx_
+    void Enqueue(const std::string& data);
+    void FlushLocked();
+    void Drop();
+};
+
+// Шард - пул рабочих потоков, с --pin привязанный к своему ядру процессора. Каждое устройство
+// (MultimeterCore со своей блокировкой и таймером) принадлежит ровно одному шарду,
+// поэтому команды разных шардов не конкурируют ни за потоки, ни за блокировки.
+struct Shard {
+    std::unique_ptr<WorkerPool> pool;
+};
 
 class Server {
 public:
-    Server(MultimeterCore& core);
+    // devices[K] - устройство devK; команды без указания устройства идут на dev0
+    Server(const std::vector<MultimeterCore*>& devices, const ServerConfig& config = ServerConfig());
     void Run();
 
+    // Ядро процессора для шарда из разрешённых процессу (sched_getaffinity), -1 - если разрешено
+    // одно ядро; используется и для потоков таймера устройств шарда при ServerConfig::pin_cpus
+    static int ShardCpu(size_t shard);
+
 private:
-    MultimeterCore& core_;
+    const std::vector<MultimeterCore*> devices_;
+    const ServerConfig config_;
+    std::vector<Shard> shards_;
+    RateLimiter limiters_[PRIORITY_CLASSES]; // Только поток ввода-вывода
     const std::string socket_path_ = "/tmp/multimeter.sock";
+    std::map<int, std::shared_ptr<ClientConnection>> clients_; // Только поток ввода-вывода
+    int wake_fds_[2] = {-1, -1}; // Канал пробуждения poll: рабочие потоки и таймеры пишут, поток ввода-вывода читает
+    uint64_t next_client_id_ = 0;
 
-    // Метод для обработки каждого клиентского соединения
-    void HandleClient(int client_fd);
+    void AcceptClient(int server_fd);
+    PriorityClass ClassifyPeer(int client_fd) const;
+    // hello priority=control|bulk - смена класса клиента; повысить класс выше разрешённого нельзя
+    std::string Hello(const std::shared_ptr<ClientConnection>& client, const std::string& command);
+    // Читает данные клиента и ставит готовые команды в очередь; false - клиент отключился
+    bool ReadClient(const std::shared_ptr<ClientConnection>& client);
+    // trace - идентификатор трассируемого запроса или 0
+    void DispatchCommand(const std::shared_ptr<ClientConnection>& client, const std::string& command, uint64_t trace);
+    // Команды самого сервера (trace_sample, trace_dump), а не устройств
+    static bool IsServerCommand(const std::string& command);
+    static std::string ProcessServerCommand(const std::string& command);
+    // Выделяет из команды устройство: "get_result dev3/channel7" -> 3, "get_result channel7";
+    // для некорректного префикса ("devX/", слишком длинный номер) device = SIZE_MAX
+    static void RouteCommand(const std::string& command, size_t& device, std::string& routed);
 };
@@ -0,0 +1,112 @@
+#include "tracer.h"
+#include <ostream>
+
+static thread_local uint64_t current_request = 0;
+
+Tracer& Tracer::Instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer() : epoch_(Clock::now()) {}
+
+void Tracer::SetSampleRate(uint32_t every) {
+    sample_every_.store(every, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::SampleRequest() {
+    uint32_t every = SampleRate();
+    if (every == 0) {
+        return 0;
+    }
+    uint64_t number = request_counter_.fetch_add(1, std::memory_order_relaxed);
+    return number % every == 0 ? number + 1 : 0;
+}
+
+Tracer::ThreadBuffer& Tracer::LocalBuffer() {
+    static thread_local std::shared_ptr<ThreadBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(registry_mtx_);
+        buffer->tid = static_cast<uint32_t>(buffers_.size() + 1);
+        buffers_.push_back(buffer);
+    }
+    return *buffer;
+}
+
+void Tracer::Record(const char* name, uint64_t request, Clock::time_point start, Clock::time_point end) {
+    ThreadBuffer& buffer = LocalBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mtx);
+    if (buffer.events.size() >= MAX_EVENTS_PER_THREAD) {
+        return; // Буфер полон - до следующей выгрузки новые интервалы теряются
+    }
+    auto since_epoch = std::chrono::duration_cast<std::chrono::microseconds>(start - epoch_);
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    buffer.events.push_back({name, request, since_epoch.count(), duration.count()});
+}
+
+void Tracer::SetThreadName(const char* name) {
+    ThreadBuffer& buffer = LocalBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mtx);
+    buffer.name = name;
+}
+
+long Tracer::Dump(std::ostream& out) {
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(registry_mtx_);
+        buffers = buffers_;
+    }
+
+    long count = 0;
+    bool first = true;
+    out << "{\"traceEvents\":[";
+    for (const auto& buffer : buffers) {
+        std::vector<Event> events;
+        const char* name;
+        {
+            std::lock_guard<std::mutex> lock(buffer->mtx);
+            events.swap(buffer->events);
+            name = buffer->name;
+        }
+        if (name) {
+            out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"args\":{\"name\":\"" << name << "\"}}";
+            first = false;
+        }
+        for (const auto& event : events) {
+            out << (first ? "" : ",") << "\n{\"name\":\"" << event.name << "\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":"
+                << event.start_us << ",\"dur\":" << event.duration_us << ",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"args\":{\"request\":" << event.request << "}}";
+            first = false;
+            ++count;
+        }
+    }
+    out << "\n]}\n";
+    return out ? count : -1;
+}
+
+TraceRequestScope::TraceRequestScope(uint64_t request) : previous_(current_request) {
+    current_request = request;
+}
+
+TraceRequestScope::~TraceRequestScope() {
+    current_request = previous_;
+}
+
+uint64_t TraceRequestScope::Current() {
+    return current_request;
+}
+
+TraceSpan::TraceSpan(const char* name, uint64_t request) : name_(name), request_(request) {
+    if (request_ != 0) {
+        start_ = Tracer::Clock::now();
+    }
+}
+
+void TraceSpan::End() {
+    if (request_ != 0) {
+        Tracer::Instance().Record(name_, request_, start_, Tracer::Clock::now());
+        request_ = 0;
+    }
+}
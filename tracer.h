@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Выборочная трассировка запросов. Интервалы (span) пишутся в буфер своего потока,
+// по команде выгружаются в формате Chrome trace-event JSON (chrome://tracing, Perfetto).
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static Tracer& Instance();
+
+    // Трассировать каждый every-й запрос; 0 - трассировка выключена
+    void SetSampleRate(uint32_t every);
+    uint32_t SampleRate() const { return sample_every_.load(std::memory_order_relaxed); }
+    bool Enabled() const { return SampleRate() != 0; }
+    // Решение о трассировке нового запроса: 0 - не трассируется, иначе идентификатор запроса
+    uint64_t SampleRequest();
+
+    void Record(const char* name, uint64_t request, Clock::time_point start, Clock::time_point end);
+    void SetThreadName(const char* name);
+    // Записывает накопленные интервалы в out и очищает буферы; возвращает число интервалов или -1
+    long Dump(std::ostream& out);
+
+private:
+    struct Event {
+        const char* name;
+        uint64_t request;
+        int64_t start_us;
+        int64_t duration_us;
+    };
+    struct ThreadBuffer {
+        std::mutex mtx; // Почти не конкурирует: его захватывает ещё только Dump
+        uint32_t tid = 0;
+        const char* name = nullptr;
+        std::vector<Event> events;
+    };
+
+    static const size_t MAX_EVENTS_PER_THREAD = 1 << 16;
+
+    Tracer();
+    ThreadBuffer& LocalBuffer();
+
+    const Clock::time_point epoch_;
+    std::atomic<uint32_t> sample_every_{0};
+    std::atomic<uint64_t> request_counter_{0};
+    std::mutex registry_mtx_;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_; // Переживают свои потоки до выгрузки
+};
+
+// Трассируемый запрос, который выполняет текущий поток; на время жизни объекта
+class TraceRequestScope {
+public:
+    explicit TraceRequestScope(uint64_t request);
+    ~TraceRequestScope();
+    static uint64_t Current();
+
+private:
+    uint64_t previous_;
+};
+
+// Интервал от создания до End() (или деструктора) для текущего трассируемого запроса
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : TraceSpan(name, TraceRequestScope::Current()) {}
+    TraceSpan(const char* name, uint64_t request);
+    ~TraceSpan() { End(); }
+    void End();
+
+private:
+    const char* name_;
+    uint64_t request_;
+    Tracer::Clock::time_point start_;
+};
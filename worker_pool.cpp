@@ -0,0 +1,103 @@
+#include "worker_pool.h"
+#include "affinity.h"
+#include <algorithm>
+#include <iterator>
+
+WorkerPool::WorkerPool(size_t worker_count, size_t queue_limit, int cpu) : queue_limit_(queue_limit), cpu_(cpu) {
+    if (worker_count == 0) {
+        worker_count = 1;
+    }
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers_.emplace_back(&WorkerPool::WorkerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+bool WorkerPool::TrySubmit(uint64_t key, std::function<void()> task, PriorityClass priority) {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!running_ || queued_[priority] >= queue_limit_) {
+            return false; // Очередь переполнена - задача отклонена
+        }
+        ++queued_[priority];
+        if (active_keys_.count(key)) {
+            blocked_[key].push_back({key, priority, std::move(task)});
+            return true;
+        }
+        active_keys_.insert(key);
+        ready_[priority].push_back({key, priority, std::move(task)});
+    }
+    cv_.notify_one();
+    return true;
+}
+
+size_t WorkerPool::QueueSize() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    size_t total = 0;
+    for (size_t queued : queued_) {
+        total += queued;
+    }
+    return total;
+}
+
+bool WorkerPool::HasReadyTask() const {
+    for (const auto& ready : ready_) {
+        if (!ready.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::WorkerLoop() {
+    PinCurrentThreadToCpu(cpu_);
+    while (true) {
+        uint64_t key;
+        {
+            std::function<void()> run;
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                cv_.wait(lock, [this]() { return !running_ || HasReadyTask(); });
+                if (!running_ && !HasReadyTask()) {
+                    return;
+                }
+                // Очереди просматриваются от высшего приоритета к низшему
+                auto& ready = *std::find_if(std::begin(ready_), std::end(ready_),
+                                            [](const std::deque<Task>& queue) { return !queue.empty(); });
+                key = ready.front().key;
+                run = std::move(ready.front().run);
+                --queued_[ready.front().priority];
+                ready.pop_front();
+            }
+            run();
+        } // Задача уничтожается до того, как освободится её ключ
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = blocked_.find(key);
+        if (it == blocked_.end()) {
+            active_keys_.erase(key);
+            continue;
+        }
+        // Следующая задача того же ключа встаёт в конец общей очереди,
+        // чтобы один клиент не занимал рабочий поток целиком
+        Task& next = it->second.front();
+        ready_[next.priority].push_back(std::move(next));
+        it->second.pop_front();
+        if (it->second.empty()) {
+            blocked_.erase(it);
+        }
+        cv_.notify_one();
+    }
+}
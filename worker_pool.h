@@ -0,0 +1,59 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Классы приоритета: свободный рабочий поток всегда берёт задачу control раньше bulk
+enum PriorityClass {
+    control_priority, // Управление прибором (операторы)
+    bulk_priority     // Массовый опрос значений
+};
+const size_t PRIORITY_CLASSES = 2;
+
+// Пул рабочих потоков фиксированного размера с ограниченными очередями задач, по одной на класс приоритета.
+// Если очередь заполнена, новая задача не принимается (TrySubmit возвращает false),
+// и вызывающая сторона сама решает, как отказать клиенту.
+// Задачи с одинаковым ключом (например, команды одного клиента) выполняются
+// строго по очереди в порядке поступления, задачи с разными ключами - параллельно.
+class WorkerPool {
+public:
+    // cpu >= 0 - все рабочие потоки пула привязываются к этому ядру процессора
+    WorkerPool(size_t worker_count, size_t queue_limit, int cpu = -1);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Лимит очереди действует для каждого класса отдельно, поэтому поток задач bulk
+    // не может вытеснить задачи control
+    bool TrySubmit(uint64_t key, std::function<void()> task, PriorityClass priority = control_priority);
+    size_t QueueSize();
+
+private:
+    struct Task {
+        uint64_t key;
+        PriorityClass priority;
+        std::function<void()> run;
+    };
+
+    std::vector<std::thread> workers_;
+    std::deque<Task> ready_[PRIORITY_CLASSES];                  // Задачи, которые можно выполнять
+    std::unordered_map<uint64_t, std::deque<Task>> blocked_;    // Ждут завершения задачи с тем же ключом
+    std::set<uint64_t> active_keys_;                            // Ключи с задачей в ready_ или в работе
+    size_t queued_[PRIORITY_CLASSES] = {};                      // Задачи в ready_ и blocked_ по классам
+    const size_t queue_limit_;
+    const int cpu_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool running_ = true;
+
+    void WorkerLoop();
+    bool HasReadyTask() const;
+};